@@ -4,16 +4,17 @@
 #include <mutex>
 
 //deadlock simply describes a situation in which two or more threads are blocked (hang) forever waiting for each other.
+//(the two test_deadlock_* run with checked_mutex_t too, see the lock order detector below: the mistake is reported instead of hanging)
 
-void test_deadlock_1(){
-  std::mutex m1, m2;
+template<typename M = std::mutex> void test_deadlock_1(){
+  M m1, m2;
 
   std::cout << "These threads are blocked forever (by mistake someone locks the mutexes in the wrong order) ...\n";
 
   bool run{true};
 
-  std::thread t1( [&run, &m1, &m2](){ while(run){ std::lock_guard<std::mutex> lk1{m1}; std::lock_guard<std::mutex> lk2{m2}; } } );
-  std::thread t2( [&run, &m1, &m2](){ while(run){ std::lock_guard<std::mutex> lk1{m2}; std::lock_guard<std::mutex> lk2{m1}; } } );
+  std::thread t1( [&run, &m1, &m2](){ while(run){ std::lock_guard<M> lk1{m1}; std::lock_guard<M> lk2{m2}; } } );
+  std::thread t2( [&run, &m1, &m2](){ while(run){ std::lock_guard<M> lk1{m2}; std::lock_guard<M> lk2{m1}; } } );
 
   std::this_thread::sleep_for( std::chrono::milliseconds(100) );
   run = false;
@@ -42,12 +43,12 @@ void test_solve_deadlock_1(){
 
 //another popular way to deadlock is by locking (by mistake) a mutex twice / multiple times from the same thread...
 
-void test_deadlock_2(){
-  std::mutex m;
+template<typename M = std::mutex> void test_deadlock_2(){
+  M m;
 
   std::cout << "This thread is blocked forever (by mistake someone locks the same mutex twice on the same thread) ...\n";
 
-  std::thread t( [&m](){ std::lock_guard<std::mutex> lk1{m}; std::lock_guard<std::mutex> lk2{m}; } );
+  std::thread t( [&m](){ std::lock_guard<M> lk1{m}; std::lock_guard<M> lk2{m}; } );
   t.join();
 }
 
@@ -60,19 +61,439 @@ void test_solve_deadlock_2(){
   t.join();
 }
 
+//-- lock order detector
+
+/*
+Both deadlocks above are only found when the program hangs (and it only hangs when the timing is "right").
+But the mistake is visible much earlier: t1 takes m1 then m2, t2 takes m2 then m1. Each order alone is fine,
+together they form a cycle m1 -> m2 -> m1, and a cycle is a deadlock waiting to happen.
+
+checked_mutex_t records these orders:
+- every thread keeps the stack of the mutexes it holds (thread_local, no synchronization)
+- before blocking on m, each held mutex h gives an edge h -> m in a global lock order graph
+- if the new edge closes a cycle the inversion is reported, BEFORE blocking (so even if this run would have been lucky)
+- if m is already on the stack, it is a re-lock of a non recursive mutex (test_deadlock_2), also reported before blocking
+
+To keep it cheap enough to leave on under load, each thread remembers the edges it already reported,
+so the global graph (and its mutex) is only touched the first time a thread sees a given edge.
+That memory is only a cache: it is dropped when it reaches MAX_KNOWN_EDGES (so the edges of mutexes that died long ago don't pile up),
+and the next lock of each edge goes through the graph once more (an inversion still there is reported again).
+In steady state a lock costs the std::mutex + a walk of the (usually 0-2 deep) held stack + a hash lookup per held mutex.
+
+The graph uses ids (never reused) instead of addresses, so a new mutex allocated at the address of a dead one starts clean.
+A mutex without a name is reported as mutex#<id>.
+
+./binary -test_deadlock_1 -checked and ./binary -test_deadlock_2 -checked run the two deadlocks above with checked_mutex_t.
+*/
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class checked_mutex_t;
+
+//what to do when something is found (report and abort by default, like the sanitizers do);
+//a handler that returns (log only) lets the lock go on and block as it would without the detector
+using lock_order_handler_t = void (*)( std::string const& );
+lock_order_handler_t lock_order_handler = []( std::string const& what ){ std::cerr << what << std::endl; std::abort(); };
+
+class lock_order_graph_t{
+public:
+  static lock_order_graph_t& instance(){ static lock_order_graph_t g; return g; }
+
+  //returns the cycle (as text) if from -> to closes one, otherwise records the edge
+  std::string add_edge( std::uint32_t from, std::uint32_t to, std::string const& from_name, std::string const& to_name ){
+    std::lock_guard<std::mutex> lk{ m_ };
+    names_[from] = from_name;
+    names_[to] = to_name;
+
+    std::vector<std::uint32_t> path;
+    if( find_path( to, from, path ) ){
+      std::string what = "lock order inversion: " + from_name + " -> " + to_name + " but already seen: ";
+      for( auto id : path ) what += names_[id] + ( id == from ? "" : " -> " );
+      return what;
+    }
+    edges_[from].insert( to );
+    return std::string();
+  }
+
+  void forget( std::uint32_t id ){
+    std::lock_guard<std::mutex> lk{ m_ };
+    edges_.erase( id );
+    for( auto& e : edges_ ) e.second.erase( id );
+    names_.erase( id );
+  }
+
+private:
+  bool find_path( std::uint32_t from, std::uint32_t to, std::vector<std::uint32_t>& path ){  //dfs, called with m_ held
+    std::unordered_set<std::uint32_t> seen;
+    std::vector< std::pair<std::uint32_t, std::vector<std::uint32_t>> > todo{ { from, { from } } };
+    while( !todo.empty() ){
+      auto cur = todo.back(); todo.pop_back();
+      if( cur.first == to ){ path = cur.second; return true; }
+      if( !seen.insert( cur.first ).second ) continue;
+      auto it = edges_.find( cur.first );
+      if( it == edges_.end() ) continue;
+      for( auto next : it->second ){
+        auto p = cur.second; p.push_back( next );
+        todo.emplace_back( next, p );
+      }
+    }
+    return false;
+  }
+
+  std::mutex m_;
+  std::unordered_map< std::uint32_t, std::unordered_set<std::uint32_t> > edges_;
+  std::unordered_map< std::uint32_t, std::string > names_;
+};
+
+#define MAX_HELD_LOCKS 16
+#define MAX_KNOWN_EDGES 4096
+
+class checked_mutex_t{
+public:
+  explicit checked_mutex_t( const char* name = nullptr ) : id_{ next_id()++ }, name_{ name } {}
+  ~checked_mutex_t(){ lock_order_graph_t::instance().forget( id_ ); }
+
+  checked_mutex_t( checked_mutex_t const& ) = delete;
+  checked_mutex_t& operator=( checked_mutex_t const& ) = delete;
+
+  void lock(){
+    auto& h = held();
+    bool relock = false;
+    for( int i=0; i<h.size; ++i ) if( h.locks[i] == this ) relock = true;
+    if( relock ) lock_order_handler( "re-lock of non recursive mutex: " + label() + " (this thread already holds it)" );
+    else for( int i=0; i<h.size; ++i ) record( *h.locks[i] );
+
+    m_.lock();  //if the handler returns: as without the detector (a re-lock hangs, like std::mutex)
+    h.push( this );
+  }
+
+  bool try_lock(){  //a try_lock can't block, so it can't deadlock: no edges
+    if( !m_.try_lock() ) return false;
+    held().push( this );
+    return true;
+  }
+
+  void unlock(){
+    held().remove( this );
+    m_.unlock();
+  }
+
+private:
+  struct held_locks_t{
+    checked_mutex_t* locks[ MAX_HELD_LOCKS ];
+    int size = 0;
+    int overflow = 0;  //deeper than that the locks are not tracked (and not checked): reported once, when it starts
+
+    void push( checked_mutex_t* m ){
+      if( size < MAX_HELD_LOCKS ){ locks[size++] = m; return; }
+      if( overflow++ == 0 )
+        lock_order_handler( std::string( "more than " ) + std::to_string( MAX_HELD_LOCKS ) + " mutexes held by one thread: " + m->label() + " and the ones after it are not checked" );
+    }
+    void remove( checked_mutex_t* m ){
+      for( int i=size-1; i>=0; --i ){  //usually the top
+        if( locks[i] == m ){ for( int j=i; j<size-1; ++j ) locks[j] = locks[j+1]; --size; return; }
+      }
+      if( overflow ) --overflow;
+    }
+  };
+
+  std::string label() const { return name_ ? std::string( name_ ) : "mutex#" + std::to_string( id_ ); }
+
+  static held_locks_t& held(){ static thread_local held_locks_t h; return h; }
+  static std::atomic<std::uint32_t>& next_id(){ static std::atomic<std::uint32_t> id{0}; return id; }
+
+  void record( checked_mutex_t const& from ){
+    static thread_local std::uint64_t recent[ 64 ];                 //direct mapped, trivially initialized (no TLS guard)
+    static thread_local std::unordered_set<std::uint64_t> known;    //everything this thread already went through the graph for
+    auto edge = ( std::uint64_t( from.id_ + 1 ) << 32 ) | id_;
+    auto& slot = recent[ ( edge ^ (edge >> 29) ) % 64 ];
+    if( slot == edge ) return;                                       //fast path
+    if( !known.count( edge ) ){
+      if( known.size() >= MAX_KNOWN_EDGES ) known.clear();
+      auto cycle = lock_order_graph_t::instance().add_edge( from.id_, id_, from.label(), label() );
+      known.insert( edge );                                          //reported once per thread, if the handler returns
+      if( !cycle.empty() ) lock_order_handler( cycle );
+    }
+    slot = edge;
+  }
+
+  std::mutex m_;
+  const std::uint32_t id_;
+  const char* name_;
+};
+
+//a handler that only counts: the inversion is reported once, and the locks are still taken
+void test_detect_deadlock(){
+  static std::atomic<int> reported{0};
+  auto previous = lock_order_handler;
+  lock_order_handler = []( std::string const& ){ ++reported; };
+
+  checked_mutex_t m1{"m1"}, m2{"m2"};
+  bool err = false;
+  long counter = 0;
+  auto other_thread_can_lock = []( checked_mutex_t& m ){
+    bool locked = false;
+    std::thread t( [&m, &locked](){ if( m.try_lock() ){ locked = true; m.unlock(); } } );
+    t.join();
+    return locked;
+  };
+
+  std::thread t1( [&](){ std::lock_guard<checked_mutex_t> lk1{m1}; std::lock_guard<checked_mutex_t> lk2{m2}; ++counter; } );
+  t1.join();
+  for( int i=0; i<3; ++i ){  //the inversion, in the same thread each time (so it can't actually deadlock)
+    std::lock_guard<checked_mutex_t> lk1{m2};
+    std::lock_guard<checked_mutex_t> lk2{m1};
+    if( other_thread_can_lock( m1 ) || other_thread_can_lock( m2 ) ) err = true;
+    ++counter;
+  }
+  if( !other_thread_can_lock( m1 ) || !other_thread_can_lock( m2 ) ) err = true;
+  if( reported != 1 || counter != 4 ) err = true;
+
+  lock_order_handler = previous;
+  std::cout << "test..." << ( err ? "failed" : "passed" ) << "\n";
+}
+
+//overhead of the detector on the uncontended path (two nested locks, the order is already known after the first iteration)
+#define LOCK_SAMPLES 10000000
+
+template<typename M> void bench_nested_locks( const char* name ){
+  M m1, m2;
+  auto start = std::chrono::high_resolution_clock::now();
+  for( int i=0; i<LOCK_SAMPLES; ++i ){ std::lock_guard<M> lk1{m1}; std::lock_guard<M> lk2{m2}; }
+  auto stop = std::chrono::high_resolution_clock::now();
+  std::cout << name << " ns per lock/unlock: " << std::chrono::duration_cast<std::chrono::nanoseconds>( stop - start ).count() / ( 2.0 * LOCK_SAMPLES ) << "\n";
+}
+
+void bench_detector(){
+  bench_nested_locks<std::mutex>( "std::mutex" );
+  bench_nested_locks<checked_mutex_t>( "checked_mutex_t" );
+}
+
+/*
+Example (on a 1 vcpu vm):
+
+./binary -test_deadlock_1 -checked
+These threads are blocked forever (by mistake someone locks the mutexes in the wrong order) ...
+lock order inversion: mutex#1 -> mutex#0 but already seen: mutex#0 -> mutex#1
+Aborted
+./binary -test_deadlock_2 -checked
+This thread is blocked forever (by mistake someone locks the same mutex twice on the same thread) ...
+re-lock of non recursive mutex: mutex#0 (this thread already holds it)
+Aborted
+./binary -test_detect_deadlock
+test...passed
+./binary -bench_detector
+std::mutex ns per lock/unlock: 10.3027
+checked_mutex_t ns per lock/unlock: 20.1942
+*/
+
+//-- owner tracking mutex
+
+/*
+test_solve_deadlock_2 "solves" the self deadlock with std::recursive_mutex, but:
+- every lock of a recursive mutex pays for the owner + counter bookkeeping, even when there is no recursion at all
+- and a thread that locks the same mutex twice is usually a design bug (the invariants are broken while the outer scope holds the lock),
+  the recursive mutex just hides it
+
+owner_mutex_t keeps the plain mutex semantics and only remembers who owns it:
+- lock() is a single CAS 0 -> "this thread" on the uncontended path (the thread id is the address of a thread_local)
+- if the CAS fails because this thread is already the owner, debug builds throw std::system_error(resource_deadlock_would_occur)
+  (the same error std::mutex is allowed to report) instead of hanging
+- an unlock by a thread that doesn't own it (or with reentries still pending) is reported and aborts in debug builds,
+  like checked_mutex_t: unlock() runs in destructors (std::lock_guard, reentry_t), where an exception would terminate anyway
+- code that really needs to go in again says so: reenter() returns a token that only counts when this thread already owns the mutex
+  (and locks it otherwise), so the recursion is explicit, visible in the code and checked
+- contention: a short spin (+yield, OWNER_MUTEX_SPINS tries, like spin_lock_t) for the locks that are held only briefly,
+  then the thread parks on a condition variable; unlock() only goes to the condition variable when someone is parked
+  (the price: unlock is a seq_cst store + a load, and the mutex carries a std::mutex + std::condition_variable for the parking)
+*/
+
+#include <system_error>
+#include <condition_variable>
+
+#define OWNER_MUTEX_SPINS 64
+
+class owner_mutex_t{
+public:
+  void lock(){
+    auto self = this_thread_tag();
+    std::uintptr_t expected = 0;
+    if( owner_.compare_exchange_strong( expected, self, std::memory_order_acquire ) ) return;  //fast path
+    lock_slow( self, expected );
+  }
+
+  bool try_lock(){
+    std::uintptr_t expected = 0;
+    return owner_.compare_exchange_strong( expected, this_thread_tag(), std::memory_order_acquire );
+  }
+
+  void unlock(){
+#ifndef NDEBUG
+    if( owner_.load( std::memory_order_relaxed ) != this_thread_tag() || reentries_ != 0 ){  //called from destructors: report and abort, don't throw
+      std::cerr << "owner_mutex_t: unlock by a non owner (or with reentries pending)" << std::endl;
+      std::abort();
+    }
+#endif
+    owner_.store( 0 );                 //seq_cst: either a parking thread sees 0, or we see it in waiters_ (no lost wake up)
+    if( waiters_.load() != 0 ){
+      std::lock_guard<std::mutex> lk{ park_m_ };
+      park_.notify_one();
+    }
+  }
+
+  class reentry_t{
+  public:
+    reentry_t( reentry_t&& o ) : m_{ o.m_ }, counted_{ o.counted_ } { o.m_ = nullptr; }
+    ~reentry_t(){
+      if( m_ == nullptr ) return;
+      if( counted_ ) --m_->reentries_; else m_->unlock();
+    }
+
+  private:
+    friend class owner_mutex_t;
+    reentry_t( owner_mutex_t* m, bool counted ) : m_{ m }, counted_{ counted } {}
+
+    owner_mutex_t *m_;
+    bool counted_;
+  };
+
+  //explicit re-entry: counts if this thread already owns the mutex, locks it otherwise
+  reentry_t reenter(){
+    if( owner_.load( std::memory_order_relaxed ) == this_thread_tag() ){
+      ++reentries_;  //only the owner touches it
+      return reentry_t{ this, true };
+    }
+    lock();
+    return reentry_t{ this, false };
+  }
+
+private:
+  static std::uintptr_t this_thread_tag(){
+    static thread_local char tag;
+    return reinterpret_cast<std::uintptr_t>( &tag );
+  }
+
+  void lock_slow( std::uintptr_t self, std::uintptr_t owner ){
+#ifndef NDEBUG
+    if( owner == self )
+      throw std::system_error( std::make_error_code( std::errc::resource_deadlock_would_occur ), "owner_mutex_t: this thread already owns the mutex (use reenter() if it is intended)" );
+#endif
+    (void)owner;
+    for( int i=0; i<OWNER_MUTEX_SPINS; ++i ){
+      std::uintptr_t expected = 0;
+      if( owner_.load( std::memory_order_relaxed ) == 0 &&
+          owner_.compare_exchange_weak( expected, self, std::memory_order_acquire ) ) return;
+      std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> lk{ park_m_ };
+    ++waiters_;
+    park_.wait( lk, [this, self](){ std::uintptr_t expected = 0; return owner_.compare_exchange_strong( expected, self ); } );
+    --waiters_;
+  }
+
+  std::atomic<std::uintptr_t> owner_{ 0 };
+  unsigned reentries_ = 0;
+  std::atomic<int> waiters_{ 0 };    //parked in lock_slow
+  std::mutex park_m_;
+  std::condition_variable park_;
+};
+
+void test_solve_deadlock_3(){
+  owner_mutex_t m;
+
+  std::cout << "This thread goes in twice on purpose (owner_mutex_t::reenter), a second plain lock would throw in debug builds ...\n";
+
+  bool err{true};
+  std::thread t( [&m, &err](){
+      std::lock_guard<owner_mutex_t> lk1{m};
+      { auto again = m.reenter(); }
+#ifndef NDEBUG
+      try{
+        std::lock_guard<owner_mutex_t> lk2{m};
+      }catch( std::system_error const& e ){
+        std::cout << "caught: " << e.what() << "\n";
+        err = false;
+      }
+#else
+      err = false; //no diagnostic in release builds (a second plain lock would simply hang, like std::mutex)
+#endif
+    });
+  t.join();
+
+  std::cout << "test..." << ( err ? "failed" : "passed" ) << "\n";
+}
+
+//uncontended: lock/unlock in a loop on one thread; contended: CONTENDERS threads incrementing a shared counter
+#define CONTENDERS 4
+
+template<typename M> void bench_mutex( const char* name ){
+  M m;
+  auto start = std::chrono::high_resolution_clock::now();
+  for( int i=0; i<LOCK_SAMPLES; ++i ){ std::lock_guard<M> lk{m}; }
+  auto stop = std::chrono::high_resolution_clock::now();
+  std::cout << name << " uncontended ns per lock/unlock: " << std::chrono::duration_cast<std::chrono::nanoseconds>( stop - start ).count() / double( LOCK_SAMPLES ) << "\n";
+
+  long counter = 0;
+  std::vector<std::thread> pool;
+  start = std::chrono::high_resolution_clock::now();
+  for( int t=0; t<CONTENDERS; ++t )
+    pool.emplace_back( [&m, &counter](){ for( int i=0; i<LOCK_SAMPLES/CONTENDERS; ++i ){ std::lock_guard<M> lk{m}; ++counter; } } );
+  for( auto& th : pool ) th.join();
+  stop = std::chrono::high_resolution_clock::now();
+  std::cout << name << " contended ns per lock/unlock: " << std::chrono::duration_cast<std::chrono::nanoseconds>( stop - start ).count() / double( LOCK_SAMPLES )
+            << ( counter == LOCK_SAMPLES/CONTENDERS*CONTENDERS ? "" : " (test...failed)" ) << "\n";
+}
+
+void bench_owner_mutex(){
+  bench_mutex<std::mutex>( "std::mutex" );
+  bench_mutex<std::recursive_mutex>( "std::recursive_mutex" );
+  bench_mutex<owner_mutex_t>( "owner_mutex_t" );
+}
+
+/*
+Example (on a 1 vcpu vm, -O2 -DNDEBUG):
+
+std::mutex uncontended ns per lock/unlock: 8.96793
+std::mutex contended ns per lock/unlock: 26.4581
+std::recursive_mutex uncontended ns per lock/unlock: 26.0228
+std::recursive_mutex contended ns per lock/unlock: 28.1335
+owner_mutex_t uncontended ns per lock/unlock: 18.2407
+owner_mutex_t contended ns per lock/unlock: 19.4591
+
+As a pure spin lock (no parking, a relaxed store in unlock) owner_mutex_t was at 10.3 / 12.1, but a thread that waited for
+a long held lock kept burning its time slice; the seq_cst store that makes the parking safe is most of the difference.
+*/
+
 //Compile: g++ file_name.cpp -std=c++11 -lpthread
 
 int main(int argc, char **argv){
-  if( argc == 2 && std::string(argv[1]) == "-test_deadlock_1" ){
-    test_deadlock_1();
+  bool checked = argc == 3 && std::string(argv[2]) == "-checked";  //the deadlocks with checked_mutex_t: reported instead of hanging
+
+  if( ( argc == 2 || checked ) && std::string(argv[1]) == "-test_deadlock_1" ){
+    checked ? test_deadlock_1<checked_mutex_t>() : test_deadlock_1();
   }else if( argc == 2 && std::string(argv[1]) == "-test_solve_deadlock_1" ){
     test_solve_deadlock_1();
-  }else if( argc == 2 && std::string(argv[1]) == "-test_deadlock_2" ){
-    test_deadlock_2();
+  }else if( ( argc == 2 || checked ) && std::string(argv[1]) == "-test_deadlock_2" ){
+    checked ? test_deadlock_2<checked_mutex_t>() : test_deadlock_2();
   }else if( argc == 2 && std::string(argv[1]) == "-test_solve_deadlock_2" ){
     test_solve_deadlock_2();
+  }else if( argc == 2 && std::string(argv[1]) == "-test_detect_deadlock" ){
+    test_detect_deadlock();
+  }else if( argc == 2 && std::string(argv[1]) == "-bench_detector" ){
+    bench_detector();
+  }else if( argc == 2 && std::string(argv[1]) == "-test_solve_deadlock_3" ){
+    test_solve_deadlock_3();
+  }else if( argc == 2 && std::string(argv[1]) == "-bench_owner_mutex" ){
+    bench_owner_mutex();
   }else{
-    std::cout << "Usage: binary -test_deadlock_1|test_slove_deadlock_1|test_deadlock_2|test_slove_deadlock_2\n";
+    std::cout << "Usage: binary -test_deadlock_1|test_slove_deadlock_1|test_deadlock_2|test_slove_deadlock_2|test_solve_deadlock_3|test_detect_deadlock|bench_detector|bench_owner_mutex (-test_deadlock_1|test_deadlock_2 -checked: with checked_mutex_t)\n";
   }
 
   return 0;
@@ -1,6 +1,15 @@
 #include <iostream>
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <stdexcept>
+#include <cstdlib>
 
 //imagine some huge objects, swap would take long time...
 
@@ -41,10 +50,216 @@ void swap3( object &d1, object &d2 ){
   std::swap( d1.data_ , d2.data_ );
 }
 
-//Compile: g++ file_name.cpp -std=c++11 -lpthread
+//-- lock manager
+
+/*
+std::lock is fine for two or three mutexes known at compile time, but:
+- a transaction that touches N objects picked at runtime can't call it (the number of arguments is fixed)
+- the algorithm is "lock one, try_lock the rest, on failure release everything and start again from the one that failed",
+  so under a tight ring (t1: a,b  t2: b,c  t3: c,a) the threads keep grabbing and releasing locks (livelock-ish, burns CPU)
+- it only knows about exclusive ownership
+
+The lock manager uses the other classic solution: all the transactions lock the objects in the same (canonical) order,
+here by address. A cycle in the wait-for graph needs someone to wait for a "smaller" lock while holding a "bigger" one, which never happens,
+so it is always safe to simply block and nobody has to back off and retry.
+
+- objects can be requested in shared (readers) or exclusive (writers) mode, the same object requested twice is merged (exclusive wins)
+- each lock is first tried (try_lock / try_lock_shared); if that fails the acquisition is counted as contended and then it blocks
+- the manager reports how many locks were acquired and how many of them were contended
+- misuse is reported like the other checked locks (owner_mutex_t, hierarchical_mutex): what is found in lock(), shared() or
+  exclusive() throws std::logic_error (nothing is held yet, or what is held stays consistent), what is found in unlock()
+  prints the error and aborts (it runs in the destructor, where an exception would only call std::terminate)
+*/
+
+#define TX_SMALL_SIZE 8
+
+class lock_manager_t{
+public:
+  using mutex_t = std::shared_timed_mutex;
+  enum mode_t { shared, exclusive };
+
+  class transaction_t{
+  public:
+    explicit transaction_t( lock_manager_t& lm ) : lm_( lm ) {}
+    transaction_t( transaction_t&& o ) : lm_( o.lm_ ), more_( std::move( o.more_ ) ), size_{ o.size_ }, locked_{ o.locked_ } {
+      if( more_.empty() ) std::copy( o.small_, o.small_ + size_, small_ );  //only the entries that were written
+      o.more_.clear(); o.size_ = 0; o.locked_ = false;  //the locks (if any) are ours now, the source must not release them
+    }
+    ~transaction_t(){ if( locked_ ) unlock(); }
+
+    transaction_t& shared( mutex_t& m ){ add( entry_t{ &m, lock_manager_t::shared } ); return *this; }
+    transaction_t& exclusive( mutex_t& m ){ add( entry_t{ &m, lock_manager_t::exclusive } ); return *this; }
+
+    void lock(){
+      if( locked_ ) throw std::logic_error( "transaction_t: already locked" );
+      //canonical order (by address) and one entry per mutex (exclusive wins)
+      std::sort( begin(), end(), []( entry_t const& x, entry_t const& y ){ return std::less<mutex_t*>()( x.m, y.m ); } );
+      auto out = begin();
+      for( auto in = begin(); in != end(); ++in ){
+        if( out != begin() && (out-1)->m == in->m ){ (out-1)->mode = std::max( (out-1)->mode, in->mode ); }
+        else{ *out++ = *in; }
+      }
+      size_ = out - begin();
+      if( !more_.empty() ) more_.resize( size_ );  //so that entries added after an unlock() go right after these
+
+      long contended = 0;
+      for( auto& e : *this ){
+        if( e.mode == lock_manager_t::exclusive ){
+          if( !e.m->try_lock() ){ ++contended; e.m->lock(); }
+        }else{
+          if( !e.m->try_lock_shared() ){ ++contended; e.m->lock_shared(); }
+        }
+      }
+      locked_ = true;
+
+      lm_.acquisitions_.fetch_add( size_, std::memory_order_relaxed );
+      if( contended ) lm_.contended_.fetch_add( contended, std::memory_order_relaxed );
+    }
+
+    void unlock(){
+      if( !locked_ ){
+        std::cerr << "transaction_t: unlock without lock" << std::endl;
+        std::abort();
+      }
+      for( auto e = end(); e != begin(); ){
+        --e;
+        if( e->mode == lock_manager_t::exclusive ) e->m->unlock(); else e->m->unlock_shared();
+      }
+      locked_ = false;
+    }
+
+  private:
+    struct entry_t{
+      mutex_t *m;
+      mode_t mode;
+    };
+
+    entry_t* begin(){ return more_.empty() ? small_ : more_.data(); }
+    entry_t* end(){ return begin() + size_; }
+
+    //most transactions touch a handful of objects, so they don't need to allocate
+    void add( entry_t e ){
+      if( locked_ ) throw std::logic_error( "transaction_t: add while locked (the new lock would never be taken)" );
+      if( size_ < TX_SMALL_SIZE && more_.empty() ){ small_[ size_++ ] = e; return; }
+      if( more_.empty() ) more_.assign( small_, small_ + size_ );
+      more_.push_back( e );
+      ++size_;
+    }
+
+    lock_manager_t& lm_;
+    entry_t small_[ TX_SMALL_SIZE ];
+    std::vector<entry_t> more_;
+    std::size_t size_ = 0;
+    bool locked_ = false;
+  };
+
+  transaction_t transaction(){ return transaction_t( *this ); }
+
+  long acquisitions() const { return acquisitions_; }
+  long contended() const { return contended_; }
+
+private:
+  std::atomic<long> acquisitions_{0}, contended_{0};
+};
+
+struct shared_object{
+  shared_object( int data ) : data_{data} {}
+
+  lock_manager_t::mutex_t mutex_;
+  int data_;
+  long sum_ = 0;
+};
+
+//the a/b/c rotation from main, but on N objects (thread t rotates objects t, t+1, t+2) and T threads
+//(each thread gets its own std::vector of objects picked at runtime for the lock manager flavour)
+
+#define BENCH_MS 200
+
+template<typename F> void bench_ring( const char* name, int objects, int threads, F rotate ){
+  std::vector< std::unique_ptr<shared_object> > o;
+  for( int i=0; i<objects; ++i ) o.emplace_back( new shared_object( i ) );
+
+  std::atomic<bool> run{true};
+  std::atomic<long> transactions{0};
+  std::vector<std::thread> pool;
+  for( int t=0; t<threads; ++t ){
+    pool.emplace_back( [&o, &run, &transactions, &rotate, objects, t](){
+        auto& a = *o[ t % objects ]; auto& b = *o[ (t+1) % objects ]; auto& c = *o[ (t+2) % objects ];
+        long n = 0;
+        while( run ){ rotate( a, b, c ); ++n; }
+        transactions += n;
+      });
+  }
+  std::this_thread::sleep_for( std::chrono::milliseconds( BENCH_MS ) );
+  run = false;
+  for( auto& th : pool ) th.join();
+
+  //a rotation only moves the values around
+  std::vector<int> values;
+  for( auto& x : o ) values.push_back( x->data_ );
+  std::sort( values.begin(), values.end() );
+  bool err = false;
+  for( int i=0; i<objects; ++i ) if( values[i] != i ) err = true;
+
+  std::cout << name << " objects: " << objects << " threads: " << threads << "\n";
+  std::cout << "test..." << ( err ? "failed" : "passed" ) << "\n";
+  std::cout << "transactions/sec: " << transactions * 1000 / BENCH_MS << "\n";
+}
+
+void bench(){
+  int configs[][2] = { {3, 3}, {16, 16}, {64, 16}, {64, 64} };
+  for( auto& cfg : configs ){
+    bench_ring( "std::lock", cfg[0], cfg[1], []( shared_object& a, shared_object& b, shared_object& c ){
+        std::lock( a.mutex_, b.mutex_, c.mutex_ );
+        std::swap( a.data_, b.data_ ); std::swap( b.data_, c.data_ );
+        a.mutex_.unlock(); b.mutex_.unlock(); c.mutex_.unlock();
+      });
+
+    lock_manager_t lm;
+    bench_ring( "lock_manager_t", cfg[0], cfg[1], [&lm]( shared_object& a, shared_object& b, shared_object& c ){
+        auto tx = lm.transaction();
+        tx.exclusive( a.mutex_ ).exclusive( b.mutex_ ).exclusive( c.mutex_ ).lock();
+        std::swap( a.data_, b.data_ ); std::swap( b.data_, c.data_ );
+      });
+    std::cout << "contended: " << lm.contended() << " / " << lm.acquisitions() << "\n";
+
+    //same ring, but only a is written (b and c are just read)
+    lock_manager_t lm2;
+    bench_ring( "lock_manager_t (1 exclusive + 2 shared)", cfg[0], cfg[1], [&lm2]( shared_object& a, shared_object& b, shared_object& c ){
+        auto tx = lm2.transaction();
+        tx.exclusive( a.mutex_ ).shared( b.mutex_ ).shared( c.mutex_ ).lock();
+        a.sum_ += b.data_ + c.data_;
+      });
+    std::cout << "contended: " << lm2.contended() << " / " << lm2.acquisitions() << "\n";
+  }
+}
+
+/*
+Example of results (on a 1 vcpu vm, -O2, transactions/sec):
+
+objects/threads   std::lock   lock_manager_t   lock_manager_t (1 exclusive + 2 shared)
+3/3               5036895     6088455          7900195
+16/16             5797530     5178050          6631475
+64/16             5882760     5659395          6945115
+64/64             7462190     7170585          9523435
+
+With a single core the threads almost never hold locks at the same time (contended ~30 out of millions,
+a few thousands for the shared flavour: a thread preempted inside its transaction still holds b and c shared),
+so std::lock never has to back off, and the two are within run to run noise of each other
+(for 3 locks the sort + bookkeeping of the lock manager costs about what std::lock's try_locks do).
+The back off / retry storms of std::lock only show up when the ring really runs in parallel;
+the lock manager never retries, and the shared flavour lets the readers of b and c overlap.
+*/
+
+//Compile: g++ file_name.cpp -std=c++14 -lpthread
 
 typedef void (*pf)( object &d1, object &d2 );
 int main(int argc, char **argv){
+  if( argc == 2 && std::string(argv[1]) == "-bench" ){
+    bench();
+    return 0;
+  }
+
   object a{1}, b{2}, c{3};
   bool run{true};
 
@@ -61,7 +276,7 @@ int main(int argc, char **argv){
   }
 
   if( swap == nullptr ){
-    std::cout << "Usage: binary -swap1|swap2|swap3\n";
+    std::cout << "Usage: binary -swap1|swap2|swap3|bench\n";
     return 0;
   }
 
@@ -0,0 +1,185 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+
+#include "sharded_counter.hpp"
+#include "spsc_ring.hpp"
+#include "broadcast_ring.hpp"
+
+//Compile: g++ broadcast_ring.cpp -std=c++17 -O2 -lpthread
+
+#define RING_CAPACITY ( 1 << 16 )
+#define READERS 4
+#define MESSAGES 100000000
+#define PUBLISH_BATCH 64
+
+struct message_t{
+  std::uint64_t sequence;
+  std::uint64_t payload;
+  std::uint64_t stage;     //written by the first stage of a chain
+  std::uint64_t b, c;      //written by two stages that run side by side
+};
+
+inline std::uint64_t payload_of( std::uint64_t i ){ return i * 0x9E3779B97F4A7C15ULL; }
+
+//the producer of the tests: n messages, alternately one by one and in batches of up to 100
+void produce( broadcast_ring_t<message_t>& ring, std::uint64_t n ){
+  std::uint64_t i = 0;
+  while( i < n ){
+    if( ( i / 1000 ) % 2 ){
+      ring.publish( [i]( message_t& m ){ m.sequence = i; m.payload = payload_of( i ); } );
+      ++i;
+    }else{
+      std::size_t batch = std::size_t( std::min<std::uint64_t>( 1 + i % 100, n - i ) );
+      auto first = ring.claim( batch );
+      for( std::size_t k=0; k<batch; ++k, ++i ){ auto& m = ring[ first + k ]; m.sequence = i; m.payload = payload_of( i ); }
+      ring.publish();
+    }
+  }
+  ring.close();
+}
+
+//every reader sees every message, in order
+void test_broadcast(){
+  error_flag_t err;
+  const std::uint64_t N = 1000000;
+  broadcast_ring_t<message_t> ring( 1024 );
+  std::vector<broadcast_ring_t<message_t>::reader_t*> readers;
+  for( int r=0; r<READERS; ++r ) readers.push_back( &ring.add_reader() );
+
+  std::vector<std::thread> pool;
+  for( int r=0; r<READERS; ++r ) pool.emplace_back( [r, &readers, &err](){
+      std::uint64_t next = 0;
+      readers[r]->run( [&next, &err]( message_t& m, std::uint64_t s ){
+          if( s != next || m.sequence != next || m.payload != payload_of( next ) ) err.set();
+          ++next;
+        }, r == 0 ? 1 : SIZE_MAX );   //one of them a message at a time
+      if( next != N ) err.set();
+    });
+  produce( ring, N );
+  for( auto& th : pool ) th.join();
+  std::cout << "test_broadcast..." << ( err.is_set() ? "failed" : "passed" ) << "\n";
+}
+
+//a diamond: stage -> ( b, c side by side ) -> last; each one sees what the ones before it wrote
+void test_chain(){
+  error_flag_t err;
+  const std::uint64_t N = 1000000;
+  broadcast_ring_t<message_t> ring( 256 );
+  auto& stage = ring.add_reader();
+  auto& b = ring.add_reader( { &stage } );
+  auto& c = ring.add_reader( { &stage } );
+  auto& last = ring.add_reader( { &b, &c } );
+
+  std::vector<std::thread> pool;
+  pool.emplace_back( [&](){ stage.run( []( message_t& m, std::uint64_t ){ m.stage = m.payload * 3; } ); } );
+  pool.emplace_back( [&](){ b.run( [&err]( message_t& m, std::uint64_t ){ if( m.stage != m.payload * 3 ) err.set(); m.b = m.stage + 1; } ); } );
+  pool.emplace_back( [&](){ c.run( [&err]( message_t& m, std::uint64_t ){ if( m.stage != m.payload * 3 ) err.set(); m.c = m.stage + 2; } ); } );
+  pool.emplace_back( [&](){
+      std::uint64_t n = 0;
+      last.run( [&err, &n]( message_t& m, std::uint64_t ){ if( m.b != m.payload * 3 + 1 || m.c != m.payload * 3 + 2 ) err.set(); ++n; } );
+      if( n != N ) err.set();
+    });
+  produce( ring, N );
+  for( auto& th : pool ) th.join();
+  std::cout << "test_chain..." << ( err.is_set() ? "failed" : "passed" ) << "\n";
+}
+
+void report( const char* name, std::chrono::high_resolution_clock::time_point start, std::vector<std::uint64_t> const& sums ){
+  auto stop = std::chrono::high_resolution_clock::now();
+  std::uint64_t expected = 0;
+  for( std::uint64_t i=0; i<MESSAGES; ++i ) expected += payload_of( i );
+  bool ok = true;
+  for( auto s : sums ) if( s != expected ) ok = false;
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>( stop - start ).count();
+  std::cout << name << ": " << MESSAGES * 1000.0 / ns << " M msgs/s to each of " << READERS << " readers ("
+            << MESSAGES * 1000.0 * READERS / ns << " M deliveries/s)" << ( ok ? "" : " (failed)" ) << "\n";
+}
+
+//the producer publishes one message at a time, or claims PUBLISH_BATCH slots and publishes them at once
+void bench_broadcast( const char* name, std::size_t batch ){
+  broadcast_ring_t<message_t> ring( RING_CAPACITY );
+  std::vector<broadcast_ring_t<message_t>::reader_t*> readers;
+  for( int r=0; r<READERS; ++r ) readers.push_back( &ring.add_reader() );
+  std::vector<std::uint64_t> sums( READERS );
+
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<std::thread> pool;
+  for( int r=0; r<READERS; ++r ) pool.emplace_back( [r, &readers, &sums](){
+      std::uint64_t sum = 0;
+      readers[r]->run( [&sum]( message_t& m, std::uint64_t ){ sum += m.payload; } );
+      sums[r] = sum;
+    });
+  for( std::uint64_t i=0; i<MESSAGES; ){
+    if( batch == 1 ){
+      ring.publish( [i]( message_t& m ){ m.sequence = i; m.payload = payload_of( i ); } );
+      ++i;
+    }else{
+      auto first = ring.claim( batch );
+      for( std::size_t k=0; k<batch; ++k, ++i ){ auto& m = ring[ first + k ]; m.sequence = i; m.payload = payload_of( i ); }
+      ring.publish();
+    }
+  }
+  ring.close();
+  for( auto& th : pool ) th.join();
+  report( name, start, sums );
+}
+
+//the alternative: a spsc_ring_t per reader, the producer pushes a copy of each message into each of them
+void bench_copies(){
+  std::vector< std::unique_ptr< spsc_ring_t<message_t> > > rings;
+  for( int r=0; r<READERS; ++r ) rings.emplace_back( new spsc_ring_t<message_t>( RING_CAPACITY ) );
+  std::vector<std::uint64_t> sums( READERS );
+  std::atomic<bool> done{ false };
+
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<std::thread> pool;
+  for( int r=0; r<READERS; ++r ) pool.emplace_back( [r, &rings, &sums, &done](){
+      std::uint64_t sum = 0;
+      for( unsigned idle = 0; ; ){
+        if( rings[r]->consume( [&sum]( message_t& m ){ sum += m.payload; }, SIZE_MAX ) ){ idle = 0; continue; }
+        if( done.load( std::memory_order_acquire ) && rings[r]->size() == 0 ) break;
+        if( ++idle > WAIT_SPINS ) std::this_thread::yield();
+      }
+      sums[r] = sum;
+    });
+  for( std::uint64_t i=0; i<MESSAGES; ++i ){
+    message_t m{ i, payload_of( i ), 0, 0, 0 };
+    for( auto& ring : rings )
+      for( unsigned idle = 0; !ring->try_push( m ); ) if( ++idle > WAIT_SPINS ) std::this_thread::yield();
+  }
+  done.store( true, std::memory_order_release );
+  for( auto& th : pool ) th.join();
+  report( "4 spsc_ring_t, a copy each  ", start, sums );
+}
+
+/*
+Example (on a 1 vcpu vm, -O2):
+
+test_broadcast...passed
+test_chain...passed
+broadcast ring, one by one  : 98.1479 M msgs/s to each of 4 readers (392.591 M deliveries/s)
+broadcast ring, batches of 64: 126.049 M msgs/s to each of 4 readers (504.197 M deliveries/s)
+4 spsc_ring_t, a copy each  : 21.7418 M msgs/s to each of 4 readers (86.9672 M deliveries/s)
+
+On one core the threads take turns: the producer fills the ring (64k messages) until the slowest reader gates it,
+then each reader handles everything published in one batch with one cursor store. So a message costs a write of
+two fields of a 40 byte slot and 4 reads of one; the one by one publish (a release store per message) is only a
+little slower than the batches. The copies pay 4 pushes per message on the producer and 4 times the memory traffic:
+5x slower. With a core per thread the readers run next to the producer, a few slots behind, and the cursors' cache
+lines are what moves between the cores (once per batch, not per message).
+*/
+
+int main(){
+  test_broadcast();
+  test_chain();
+  bench_broadcast( "broadcast ring, one by one  ", 1 );
+  bench_broadcast( "broadcast ring, batches of 64", PUBLISH_BATCH );
+  bench_copies();
+  return 0;
+}
@@ -0,0 +1,164 @@
+#ifndef BROADCAST_RING_HPP
+#define BROADCAST_RING_HPP
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <initializer_list>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+#include "cache_line.hpp"
+
+/*
+One Producer - many readers broadcast ring (the LMAX Disruptor's ring buffer)
+
+std::shared_future fans one value out to several threads, once. For a stream every reader has to see every message:
+N queues cost N copies of each message and N pushes on the producer. Here there is one ring, and the messages are written
+once and read in place by everybody:
+
+  readers' cursors (the slowest one gates the producer)        published (producer)
+        |         |                                                |
+  [ x ][ x ][ x ][ x ][ x ][ x ][ x ][ x ][ x ][ x ][ x ][ x ][   ][   ]      slot = sequence & mask
+
+- sequences only grow (64 bits never wrap); the producer owns published_, every reader owns its cursor_
+  (the count of messages it is done with), each on its own cache line
+- the producer claims slots, writes them in place and publishes them (one release store for a whole batch);
+  it may only claim a slot once every reader's cursor is past the message that was there (gate: capacity behind
+  the slowest reader). The minimum of the cursors is cached and only recomputed when the claim reaches it
+- a reader sees everything below published_ (acquire), handles a batch in place (f( T&, sequence ) on each slot)
+  and then moves its cursor once (release): the cursor stores are per batch, not per message
+- dependency chains: a reader added after other readers only sees what all of them are done with, instead of what
+  is published (journal -> replicate -> business logic in the Disruptor paper). Such a reader can read what its
+  dependencies wrote in the message; readers that run side by side must only read it
+- waiting: the producer (ring full) and the readers (nothing new) spin WAIT_SPINS times, then yield
+  (on one core the one they wait for can't run while they spin)
+
+The readers are added before the producer starts (add_reader is not thread safe with the producer),
+each reader is used by one thread. close() ends the stream: a reader's run() returns when it has seen everything.
+*/
+
+#define WAIT_SPINS 64
+
+template<typename T> class broadcast_ring_t{
+public:
+  class reader_t{
+  public:
+    //f( T& message, std::uint64_t sequence ) on up to max available messages, in place; returns how many (0: none yet)
+    template<typename F> std::size_t consume( F&& f, std::size_t max = SIZE_MAX ){
+      auto cursor = cursor_.load( std::memory_order_relaxed );
+      if( cursor == limit_cache_ ){
+        limit_cache_ = limit();
+        if( cursor == limit_cache_ ) return 0;
+      }
+      auto end = limit_cache_ - cursor > max ? cursor + max : limit_cache_;
+      for( auto s = cursor; s < end; ++s ) f( ring_.slots_[ s & ring_.mask_ ], s );
+      cursor_.store( end, std::memory_order_release );
+      return std::size_t( end - cursor );
+    }
+
+    //consume() until the ring is closed and everything was seen
+    template<typename F> void run( F&& f, std::size_t batch = SIZE_MAX ){
+      for( unsigned idle = 0; ; ){
+        if( consume( f, batch ) ){ idle = 0; continue; }
+        if( ring_.closed_.load( std::memory_order_acquire ) && cursor_.load( std::memory_order_relaxed ) == ring_.published_.load( std::memory_order_acquire ) ) return;
+        if( ++idle > WAIT_SPINS ) std::this_thread::yield();
+      }
+    }
+
+    std::uint64_t cursor() const { return cursor_.load( std::memory_order_acquire ); }
+
+  private:
+    friend class broadcast_ring_t;
+    reader_t( broadcast_ring_t& ring, std::vector<reader_t*> after ) : ring_{ ring }, after_{ std::move( after ) } {}
+
+    //what this reader may see: what is published, or what all its dependencies are done with
+    std::uint64_t limit() const {
+      if( after_.empty() ) return ring_.published_.load( std::memory_order_acquire );
+      auto l = after_[0]->cursor();
+      for( auto r : after_ ) if( r->cursor() < l ) l = r->cursor();
+      return l;
+    }
+
+    alignas(CACHE_LINE_SIZE) std::atomic<std::uint64_t> cursor_{ 0 };
+    std::uint64_t limit_cache_ = 0;
+    broadcast_ring_t& ring_;
+    std::vector<reader_t*> after_;
+  };
+
+  explicit broadcast_ring_t( std::size_t capacity ) : mask_{ round_up( capacity ) - 1 }, slots_{ new T[ mask_ + 1 ] } {}
+
+  broadcast_ring_t( broadcast_ring_t const& ) = delete;
+  broadcast_ring_t& operator=( broadcast_ring_t const& ) = delete;
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+  //before the producer starts; the reader sees a message once all the readers in after are done with it
+  reader_t& add_reader( std::initializer_list<reader_t*> after = {} ){
+    for( auto r : after ) if( &r->ring_ != this ) throw std::logic_error( "broadcast_ring_t: dependency on another ring" );
+    readers_.emplace_back( new reader_t( *this, after ) );
+    return *readers_.back();
+  }
+
+  //producer only: n (<= capacity) slots from the returned sequence on, waits while the slowest reader is too far behind
+  std::uint64_t claim( std::size_t n = 1 ){
+    auto first = claimed_;
+    claimed_ += n;
+    for( unsigned idle = 0; claimed_ - gate_cache_ > capacity(); ){
+      gate_cache_ = gate();
+      if( claimed_ - gate_cache_ <= capacity() ) break;
+      if( ++idle > WAIT_SPINS ) std::this_thread::yield();
+    }
+    return first;
+  }
+
+  //producer only: false (nothing claimed) if the n slots are not free yet
+  bool try_claim( std::size_t n, std::uint64_t& first ){
+    if( claimed_ + n - gate_cache_ > capacity() ){
+      gate_cache_ = gate();
+      if( claimed_ + n - gate_cache_ > capacity() ) return false;
+    }
+    first = claimed_;
+    claimed_ += n;
+    return true;
+  }
+
+  //the slot of a claimed sequence (the producer writes it in place)
+  T& operator[]( std::uint64_t sequence ){ return slots_[ sequence & mask_ ]; }
+
+  //producer only: everything claimed so far becomes visible to the readers
+  void publish(){ published_.store( claimed_, std::memory_order_release ); }
+
+  //producer only: claim one slot, fill( T& ) it in place and publish it
+  template<typename F> void publish( F&& fill ){
+    auto s = claim( 1 );
+    fill( slots_[ s & mask_ ] );
+    publish();
+  }
+
+  //producer only, after the last publish()
+  void close(){ closed_.store( true, std::memory_order_release ); }
+
+private:
+  static std::size_t round_up( std::size_t n ){ std::size_t c = 2; while( c < n ) c <<= 1; return c; }
+
+  //the slowest reader (no readers: nobody gates the producer)
+  std::uint64_t gate() const {
+    auto g = claimed_;
+    for( auto& r : readers_ ){ auto c = r->cursor(); if( c < g ) g = c; }
+    return g;
+  }
+
+  const std::size_t mask_;
+  std::unique_ptr<T[]> slots_;
+  std::vector< std::unique_ptr<reader_t> > readers_;
+  //the producer's
+  alignas(CACHE_LINE_SIZE) std::atomic<std::uint64_t> published_{ 0 };
+  std::atomic<bool> closed_{ false };
+  alignas(CACHE_LINE_SIZE) std::uint64_t claimed_ = 0;
+  std::uint64_t gate_cache_ = 0;
+};
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef CACHE_LINE_HPP
+#define CACHE_LINE_HPP
+
+/*
+The one cache line size of the tree: everything that must not share a line with a neighbour
+(per thread slots, head / tail indices, counter cells, spin locks) is aligned to it.
+
+64 bytes on x86-64 and most arm64 cores (std::hardware_destructive_interference_size is C++17
+and gcc warns that its value may change, so a plain constant it is).
+*/
+
+#define CACHE_LINE_SIZE 64
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef CONCURRENT_PRIORITY_QUEUE_HPP
+#define CONCURRENT_PRIORITY_QUEUE_HPP
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <thread>
+#include <functional>
+#include <climits>
+#include <cstdint>
+#include <cstddef>
+
+#include "cache_line.hpp"
+#include "spin_lock.hpp"
+
+/*
+Concurrent priority queue (MultiQueue: Rihani, Sanders, Dementiev - MultiQueues: Simple Relaxed Concurrent Priority Queues)
+
+concurrent_queue_t / concurrent_queue are FIFO: a control message pushed behind 100k bulk messages waits for all of them.
+A priority queue with one lock is exact, but every push and pop goes through that lock (and an O(log n) heap operation
+inside it): with many threads the lock is the queue's throughput.
+
+MultiQueue: `queues` sequential heaps, each behind its own spin_lock_t (about MULTIQUEUE_FACTOR per core):
+- push puts the item in a random heap (try_lock; a busy heap is skipped for another random one)
+- pop looks at two random heaps, compares their tops (each heap publishes its top priority in an atomic,
+  so the look needs no lock) and pops from the better one
+- so the threads spread over the heaps and almost never wait on a lock, at the price of order:
+  a pop returns one of the best items, not always the best (the rank error is about `queues` on average).
+  For a control message among bulk ones that means it is out after a few pops, not after the whole backlog
+- if both heaps look empty the pop scans all of them before it says the queue is empty
+
+The priority is an int, the higher the more urgent (as std::priority_queue). Within a heap, the same priority is FIFO.
+
+Same semantics as the existing queues:
+- try_pop( v ): non blocking, false if the queue is empty (concurrent_queue_t::pop)
+- pop( v ): blocks until there is an item (concurrent_queue::pop). The waiters sleep on a condition variable; a push only
+  takes its mutex when somebody sleeps (size_ and waiters_ are both seq_cst: either the push sees the waiter,
+  or the waiter sees the item before it sleeps)
+With queues = 1 it is an exact priority queue behind one lock.
+*/
+
+#define MULTIQUEUE_FACTOR 2
+#define POP_SPINS 64          //try_pop()s before a blocking pop goes to sleep
+
+template<typename T>
+class concurrent_priority_queue_t{
+public:
+  explicit concurrent_priority_queue_t( std::size_t queues = 0 )
+    : n_{ queues ? queues : std::max<std::size_t>( 2, MULTIQUEUE_FACTOR * std::thread::hardware_concurrency() ) },
+      heaps_{ new heap_t[ n_ ] }
+  {}
+
+  concurrent_priority_queue_t( concurrent_priority_queue_t const& ) = delete;
+  concurrent_priority_queue_t& operator=( concurrent_priority_queue_t const& ) = delete;
+
+  void push( int priority, T const& v ){
+    for( std::size_t misses=1; ; ++misses ){
+      auto& h = heaps_[ random_heap() ];
+      if( !h.lock.try_lock() ){
+        if( misses % n_ == 0 ) std::this_thread::yield();   //all busy: their holders may be preempted
+        continue;
+      }
+      h.items.push_back( entry_t{ priority, h.seq++, v } );
+      std::push_heap( h.items.begin(), h.items.end(), less );
+      h.publish();
+      h.lock.unlock();
+      break;
+    }
+    size_.fetch_add( 1, std::memory_order_seq_cst );
+    if( waiters_.load( std::memory_order_seq_cst ) ){
+      std::lock_guard<std::mutex> lk{ m_ };
+      c_.notify_one();
+    }
+  }
+
+  //false if the queue is empty
+  bool try_pop( T& v ){
+    for( int attempt=0; attempt<4; ++attempt ){
+      auto& a = heaps_[ random_heap() ];
+      auto& b = heaps_[ random_heap() ];
+      auto& h = a.top.load( std::memory_order_relaxed ) >= b.top.load( std::memory_order_relaxed ) ? a : b;
+      if( h.top.load( std::memory_order_relaxed ) == EMPTY ) break;   //both look empty
+      if( !h.lock.try_lock() ) continue;
+      bool ok = take( h, v );
+      h.lock.unlock();
+      if( ok ) return true;
+    }
+    //unlucky, or (nearly) empty: every heap in turn
+    for( std::size_t i=0; i<n_; ++i ){
+      auto& h = heaps_[i];
+      if( h.top.load( std::memory_order_relaxed ) == EMPTY ) continue;
+      std::lock_guard< spin_lock_t > lk{ h.lock };
+      if( take( h, v ) ) return true;
+    }
+    return false;
+  }
+
+  //blocks until there is an item
+  void pop( T& v ){
+    for( int i=0; i<POP_SPINS; ++i ){
+      if( try_pop( v ) ) return;
+      std::this_thread::yield();
+    }
+    for(;;){
+      {
+        std::unique_lock<std::mutex> lk{ m_ };
+        waiters_.fetch_add( 1, std::memory_order_seq_cst );
+        c_.wait( lk, [this](){ return size_.load( std::memory_order_seq_cst ) > 0; } );
+        waiters_.fetch_sub( 1, std::memory_order_relaxed );
+      }
+      if( try_pop( v ) ) return;   //somebody else was faster
+    }
+  }
+
+  //a moment's picture
+  std::size_t size() const { return std::size_t( std::max<long>( 0, size_.load( std::memory_order_relaxed ) ) ); }
+  std::size_t queues() const { return n_; }
+
+private:
+  static constexpr long long EMPTY = LLONG_MIN;
+
+  struct entry_t{
+    int priority;
+    std::uint64_t seq;
+    T value;
+  };
+
+  static bool less( entry_t const& a, entry_t const& b ){
+    return a.priority < b.priority || ( a.priority == b.priority && a.seq > b.seq );
+  }
+
+  struct alignas(CACHE_LINE_SIZE) heap_t{
+    spin_lock_t lock;
+    std::atomic<long long> top{ EMPTY };   //the priority on top, read without the lock
+    std::uint64_t seq = 0;
+    std::vector<entry_t> items;
+
+    void publish(){ top.store( items.empty() ? EMPTY : items.front().priority, std::memory_order_relaxed ); }
+  };
+
+  //under h.lock
+  bool take( heap_t& h, T& v ){
+    if( h.items.empty() ) return false;
+    std::pop_heap( h.items.begin(), h.items.end(), less );
+    v = std::move( h.items.back().value );
+    h.items.pop_back();
+    h.publish();
+    size_.fetch_sub( 1, std::memory_order_relaxed );
+    return true;
+  }
+
+  std::size_t random_heap() const {
+    static thread_local std::uint32_t x = std::uint32_t( std::hash<std::thread::id>()( std::this_thread::get_id() ) ) | 1;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    return x % n_;
+  }
+
+  const std::size_t n_;
+  std::unique_ptr< heap_t[] > heaps_;
+  alignas(CACHE_LINE_SIZE) std::atomic<long> size_{ 0 };   //pushed - popped (a pop may count before the push does: briefly -1)
+  alignas(CACHE_LINE_SIZE) std::atomic<int> waiters_{ 0 };
+  std::mutex m_;
+  std::condition_variable c_;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef EPOCH_RECLAMATION_HPP
+#define EPOCH_RECLAMATION_HPP
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+#include "cache_line.hpp"
+
+/*
+Epoch based memory reclamation (EBR)
+
+lock_free_queue_t can delete a node as soon as it is consumed because only one thread ever looks at it.
+With many threads, a thread that unlinked a node can't know if another thread still holds a pointer to it
+(it loaded it just before the unlink and is about to read it): deleting it is a use after free, and reusing it is ABA.
+
+EBR: a thread reads shared nodes only inside a critical section (pin() .. the guard's destructor), and nodes are
+not deleted but retired: deleted later, when no critical section that could have seen them is left.
+
+- a global epoch; a pinned thread announces the epoch it saw (its local epoch, with an "active" bit)
+- the global epoch moves e -> e+1 only when every active thread announced e, so a pinned thread is at most one epoch behind
+- a node retired in epoch e was unlinked before the retire; whoever can still hold it was pinned at e-1 or e.
+  When the global epoch is e+2 all of those have left their critical section: the node is deleted
+- every thread keeps its retired nodes in 3 buckets (epoch % 3); every EBR_RETIRE_THRESHOLD retires it tries to
+  advance the epoch and deletes the buckets that are 2 epochs old
+
+The garbage is bounded as long as no thread stays pinned: a thread that blocks inside a critical section stops
+all the reclamation (the price of EBR; hazard pointers bound the garbage even then, but cost a fence per pointer read).
+Critical sections should be short: one operation on the structure.
+A thread preempted while pinned does the same for a time slice, and with more threads than cores that happens all
+the time: a thread with more than EBR_MAX_PENDING retired nodes that can't advance the epoch yields, so the pinned
+thread gets to run and leave. That keeps the garbage around EBR_MAX_PENDING per thread (without it: a time slice
+worth of retires per thread, hundreds of thousands of nodes with 16 threads on a core).
+
+Usage:
+  ebr_domain_t ebr;                      //one per structure (or shared by several)
+  ebr_handle_t h( ebr );                 //once per thread
+  {
+    auto g = h->pin();
+    auto old = head.load(); ... CAS it out ...
+    h->retire( old );                    //deleted when nobody can see it anymore
+  }
+
+The records of the threads are never freed while the domain lives (a detached record is reused by the next attach).
+What a detached thread could not delete yet goes to the domain's orphans, deleted by the next reclaim() of another
+thread that finds them old enough. The domain's destructor deletes all the garbage: no thread may be pinned then.
+*/
+
+#define EBR_RETIRE_THRESHOLD 128
+#define EBR_MAX_PENDING ( 16 * EBR_RETIRE_THRESHOLD )
+
+class ebr_domain_t{
+public:
+  class thread_t;
+
+  class guard_t{
+  public:
+    explicit guard_t( thread_t& t ) : t_{ &t } { t_->enter(); }
+    guard_t( guard_t&& o ) : t_{ o.t_ } { o.t_ = nullptr; }
+    ~guard_t(){ if( t_ ) t_->leave(); }
+    guard_t( guard_t const& ) = delete;
+    guard_t& operator=( guard_t const& ) = delete;
+  private:
+    thread_t* t_;
+  };
+
+  class alignas(CACHE_LINE_SIZE) thread_t{
+  public:
+    //critical sections nest: only the outermost one announces an epoch
+    guard_t pin(){ return guard_t( *this ); }
+
+    template<typename T> void retire( T* p ){
+      auto e = d_.epoch_.load( std::memory_order_seq_cst );
+      auto& b = limbo_[ e % 3 ];
+      if( b.epoch != e ){ free( b ); b.epoch = e; }   //what is there was retired in e-3 or before
+      b.items.push_back( retired_t{ p, []( void* x ){ delete static_cast<T*>( x ); } } );
+      pending_.store( pending_.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+      if( ++since_scan_ >= EBR_RETIRE_THRESHOLD ){
+        since_scan_ = 0;
+        //too much garbage: a pinned thread is probably preempted, give it the core to leave its critical section
+        if( !d_.try_advance() && pending() > EBR_MAX_PENDING ) std::this_thread::yield();
+        reclaim();
+      }
+    }
+
+    //deletes what is 2 epochs old (and the leftovers of the detached threads)
+    void reclaim(){
+      auto e = d_.epoch_.load( std::memory_order_acquire );
+      for( auto& b : limbo_ ) if( !b.items.empty() && b.epoch + 2 <= e ) free( b );
+      d_.reclaim_orphans( e );
+    }
+
+    std::size_t pending() const { return pending_.load( std::memory_order_relaxed ); }
+
+  private:
+    friend class ebr_domain_t;
+    explicit thread_t( ebr_domain_t& d ) : d_{ d } {}
+    ~thread_t(){ for( auto& b : limbo_ ) free( b ); }
+
+    struct retired_t{
+      void* p;
+      void (*destroy)( void* );
+    };
+    struct bucket_t{
+      std::uint64_t epoch = 0;
+      std::vector<retired_t> items;
+    };
+
+    void enter(){
+      if( nesting_++ ) return;
+      auto e = d_.epoch_.load( std::memory_order_relaxed );
+      local_.store( ( e << 1 ) | 1, std::memory_order_relaxed );
+      std::atomic_thread_fence( std::memory_order_seq_cst );   //announced before any shared pointer is read
+    }
+
+    void leave(){
+      if( --nesting_ ) return;
+      local_.store( local_.load( std::memory_order_relaxed ) & ~std::uint64_t( 1 ), std::memory_order_release );
+    }
+
+    void free( bucket_t& b ){
+      for( auto& r : b.items ) r.destroy( r.p );
+      pending_.store( pending_.load( std::memory_order_relaxed ) - b.items.size(), std::memory_order_relaxed );
+      b.items.clear();
+    }
+
+    ebr_domain_t& d_;
+    std::atomic<std::uint64_t> local_{ 0 };      //epoch << 1 | active
+    std::atomic<bool> in_use_{ false };
+    thread_t* next_ = nullptr;                   //the list of records, set once before the record is published
+    //the owner's
+    unsigned nesting_ = 0;
+    std::size_t since_scan_ = 0;
+    bucket_t limbo_[3];
+    std::atomic<std::size_t> pending_{ 0 };      //only the owner writes it
+  };
+
+  ebr_domain_t() = default;
+  ebr_domain_t( ebr_domain_t const& ) = delete;
+  ebr_domain_t& operator=( ebr_domain_t const& ) = delete;
+
+  ~ebr_domain_t(){
+    for( auto& b : orphans_ ) for( auto& r : b.items ) r.destroy( r.p );
+    auto t = head_.load();
+    while( t ){ auto next = t->next_; delete t; t = next; }
+  }
+
+  //a free record, or a new one pushed on the list (the list only grows, so walking it needs no protection)
+  thread_t& attach(){
+    for( auto t = head_.load( std::memory_order_acquire ); t; t = t->next_ ){
+      bool expected = false;
+      if( !t->in_use_.load( std::memory_order_relaxed ) && t->in_use_.compare_exchange_strong( expected, true, std::memory_order_acquire ) ) return *t;
+    }
+    auto t = new thread_t( *this );
+    t->in_use_.store( true, std::memory_order_relaxed );
+    t->next_ = head_.load( std::memory_order_relaxed );
+    while( !head_.compare_exchange_weak( t->next_, t, std::memory_order_release, std::memory_order_relaxed ) );
+    return *t;
+  }
+
+  //not pinned; what can't be deleted yet goes to the orphans, deleted by the reclaim() of the other threads
+  void detach( thread_t& t ){
+    for( int i=0; i<3 && t.pending(); ++i ){ try_advance(); t.reclaim(); }
+    if( t.pending() ){
+      std::lock_guard<std::mutex> lock( orphans_mutex_ );
+      for( auto& b : t.limbo_ ){
+        if( b.items.empty() ) continue;
+        orphans_.emplace_back();
+        orphans_.back().epoch = b.epoch;
+        orphans_.back().items.swap( b.items );
+        orphans_pending_ += orphans_.back().items.size();
+      }
+      t.pending_.store( 0, std::memory_order_relaxed );
+      orphans_n_.store( orphans_.size(), std::memory_order_release );
+    }
+    t.in_use_.store( false, std::memory_order_release );
+  }
+
+  //true if the epoch moved (a failed CAS means somebody else moved it)
+  bool try_advance(){
+    auto e = epoch_.load( std::memory_order_seq_cst );
+    for( auto t = head_.load( std::memory_order_acquire ); t; t = t->next_ ){
+      auto l = t->local_.load( std::memory_order_seq_cst );
+      if( ( l & 1 ) && ( l >> 1 ) != e ) return false;   //pinned in the previous epoch
+    }
+    epoch_.compare_exchange_strong( e, e + 1, std::memory_order_seq_cst );
+    return true;
+  }
+
+  //retired, not deleted yet (all the threads; a moment's picture)
+  std::size_t pending() const {
+    std::size_t n = 0;
+    for( auto t = head_.load( std::memory_order_acquire ); t; t = t->next_ ) n += t->pending();
+    std::lock_guard<std::mutex> lock( orphans_mutex_ );
+    return n + orphans_pending_;
+  }
+
+  std::uint64_t epoch() const { return epoch_.load( std::memory_order_relaxed ); }
+
+private:
+  //nothing to do most of the time: one load
+  void reclaim_orphans( std::uint64_t e ){
+    if( !orphans_n_.load( std::memory_order_acquire ) ) return;
+    std::unique_lock<std::mutex> lock( orphans_mutex_, std::try_to_lock );
+    if( !lock ) return;
+    for( std::size_t i=0; i<orphans_.size(); ){
+      if( orphans_[i].epoch + 2 > e ){ ++i; continue; }
+      for( auto& r : orphans_[i].items ) r.destroy( r.p );
+      orphans_pending_ -= orphans_[i].items.size();
+      orphans_[i] = std::move( orphans_.back() );
+      orphans_.pop_back();
+    }
+    orphans_n_.store( orphans_.size(), std::memory_order_release );
+  }
+
+  alignas(CACHE_LINE_SIZE) std::atomic<std::uint64_t> epoch_{ 2 };   //starts at 2: bucket epoch 0 is always old enough
+  alignas(CACHE_LINE_SIZE) std::atomic<thread_t*> head_{ nullptr };
+  alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> orphans_n_{ 0 };
+  mutable std::mutex orphans_mutex_;
+  std::vector<thread_t::bucket_t> orphans_;
+  std::size_t orphans_pending_ = 0;
+};
+
+using ebr_thread_t = ebr_domain_t::thread_t;
+
+//attach for the lifetime of a scope (a thread)
+class ebr_handle_t{
+public:
+  explicit ebr_handle_t( ebr_domain_t& d ) : d_{ d }, t_{ d.attach() } {}
+  ~ebr_handle_t(){ d_.detach( t_ ); }
+  ebr_handle_t( ebr_handle_t const& ) = delete;
+  ebr_handle_t& operator=( ebr_handle_t const& ) = delete;
+
+  ebr_thread_t* operator->(){ return &t_; }
+  ebr_thread_t& operator*(){ return t_; }
+
+private:
+  ebr_domain_t& d_;
+  ebr_thread_t& t_;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef FLAT_COMBINING_HPP
+#define FLAT_COMBINING_HPP
+
+#include <atomic>
+#include <thread>
+#include <type_traits>
+
+#include "cache_line.hpp"
+#include "spin_lock.hpp"
+
+/*
+Flat combining (Hendler, Incze, Shavit, Tzafrir - Flat Combining and the Synchronization-Parallelism Tradeoff)
+
+- every thread publishes its request in a slot (on its own cache line) and then tries to grab the lock
+- whoever gets the lock becomes the combiner and runs all the published requests in one pass
+- the other threads just spin (+yield) on their own slot until the combiner marks the request as done
+
+So instead of handing the lock (and the shared structure) from core to core for each operation,
+the shared structure stays hot in the combiner's cache for a whole batch of operations.
+
+Slots:
+  free -> claimed (owner fills in the request) -> pending (visible to the combiner) -> done (result is ready) -> free
+A thread remembers the last slot it used, so with less threads than slots everyone keeps its own slot.
+
+execute( f ) runs f inside the critical section (and returns once it ran, so f may write its result to the caller's stack).
+lock() / unlock() take the combiner lock directly (bypassing the slots) for coarse grained work.
+
+Used by concurrent_queue_t (producer backend) and by the caches in avoid_data_races.cpp.
+*/
+
+#define COMBINING_SLOTS 64
+
+class combining_backend_t{
+private:
+  enum { slot_free, slot_claimed, slot_pending, slot_done };
+
+  struct alignas(CACHE_LINE_SIZE) slot_t{   //a whole cache line each: the slots of two threads must not share one
+    std::atomic<int> state_{ slot_free };
+    void (*run_)( void* ){ nullptr };
+    void *request_{ nullptr };
+  };
+
+  spin_lock_t lock_;
+  slot_t slots_[ COMBINING_SLOTS ];
+
+  slot_t& claim(){
+    static thread_local unsigned hint = 0;
+    for( unsigned n=0; ; ++n ){
+      unsigned i = (hint+n) % COMBINING_SLOTS;
+      int expected = slot_free;
+      if( slots_[i].state_.load( std::memory_order_relaxed ) == slot_free &&
+          slots_[i].state_.compare_exchange_strong( expected, slot_claimed, std::memory_order_acquire ) ){
+        hint = i;
+        return slots_[i];
+      }
+      if( i == COMBINING_SLOTS-1 ) std::this_thread::yield(); //more threads than slots...
+    }
+  }
+
+  void combine(){ //called only while holding the lock
+    for( auto& slot : slots_ ){
+      if( slot.state_.load( std::memory_order_acquire ) == slot_pending ){
+        slot.run_( slot.request_ );
+        slot.state_.store( slot_done, std::memory_order_release );
+      }
+    }
+  }
+
+public:
+  template<typename F> void execute( F&& f ){
+    auto& slot = claim();
+    slot.request_ = &f;
+    slot.run_ = []( void* request ){ (*static_cast< typename std::remove_reference<F>::type* >( request ))(); };
+    slot.state_.store( slot_pending, std::memory_order_release );    //publish the request
+
+    while( slot.state_.load( std::memory_order_acquire ) != slot_done ){
+      if( lock_.try_lock() ){                                       //become the combiner
+        combine();
+        lock_.unlock();
+      }else{
+        std::this_thread::yield();
+      }
+    }
+
+    slot.state_.store( slot_free, std::memory_order_release );      //give the slot back
+  }
+
+  void lock(){ lock_.lock(); }
+  void unlock(){ lock_.unlock(); }
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+
+#include "spin_lock.hpp"
+#include "sharded_counter.hpp"
+#include "lock_free_stack.hpp"
+
+//Compile: g++ lock_free_stack.cpp -std=c++17 -O2 -lpthread
+
+#define SAMPLES 1000000
+#define SPLITS 4
+#define BUFFERS 256
+#define BUFFER_SIZE 4096
+#define FREELIST_OPS 4000000
+
+//the baseline: a std::vector behind the spin lock of concurrent_queue_t
+template<typename T>
+class locked_stack_t{
+public:
+  void push( T const& v ){
+    std::lock_guard< spin_lock_t > lk{ lock_ };
+    v_.push_back( v );
+  }
+
+  bool pop( T& v ){
+    std::lock_guard< spin_lock_t > lk{ lock_ };
+    if( v_.empty() ) return false;
+    v = v_.back();
+    v_.pop_back();
+    return true;
+  }
+
+private:
+  spin_lock_t lock_;
+  std::vector<T> v_;
+};
+
+//how many push / pop pairs skipped top (only the lock-free stack has an elimination array)
+template<typename S> void print_eliminated( S const& ){}
+template<typename T> void print_eliminated( lock_free_stack_t<T> const& s ){ std::cout << "eliminated: " << s.eliminated() << "\n"; }
+
+//single thread: LIFO order, empty, and the freed nodes are reused
+void test_lifo(){
+  bool err = false;
+  lock_free_stack_t<int> s;
+  int v;
+  if( !s.empty() || s.pop( v ) ) err = true;
+  for( int round=0; round<3; ++round ){
+    for( int i=0; i<10000; ++i ) s.push( i );
+    for( int i=9999; i>=0; --i ) if( !s.pop( v ) || v != i ) err = true;
+    if( !s.empty() || s.pop( v ) ) err = true;
+  }
+  std::cout << "test_lifo..." << ( err ? "failed" : "passed" ) << "\n";
+}
+
+//as test_concurrent_queue_2: splits producers push their part of v1, splits consumers pop until everything is out;
+//every value must come out exactly once
+template<typename S, typename... A> void test_stack_2( int splits = SPLITS, A... args ){
+  S st( args... );
+
+  std::vector<int> v1( SAMPLES ), v2;
+  for( int i=0; i<SAMPLES; ++i ) v1[i] = i;
+
+  sharded_counter_t consumed;
+  std::vector< std::vector<int> > popped( splits );
+
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<std::thread> pool;
+  for( int id=0; id<splits; ++id ){
+    pool.emplace_back( std::thread( [id, splits, &v1, &st](){ for( int i=0; i<SAMPLES/splits; ++i ){ st.push( v1[ id*SAMPLES/splits + i ] ); } } ) );
+    pool.emplace_back( std::thread( [id, &consumed, &popped, &st](){
+        auto& mine = popped[id];
+        mine.reserve( SAMPLES );
+        int v;
+        unsigned idle = 0;
+        for(;;){
+          if( st.pop(v) ){ mine.push_back( v ); consumed.add(); }
+          else if( ++idle % 16 == 0 && consumed.read() >= SAMPLES ) break;
+        }
+      } ) );
+  }
+
+  for( auto& th : pool ) th.join();
+
+  auto stop = std::chrono::high_resolution_clock::now();
+  auto elapsed = stop - start;
+
+  for( auto& p : popped ) v2.insert( v2.end(), p.begin(), p.end() );
+  std::sort( v2.begin(), v2.end() );
+
+  std::cout << "test..." << ( v1 != v2 ? "failed" : "passed" ) << "\n";
+  std::cout << "elapsed: " << std::chrono::duration_cast<std::chrono::milliseconds>( elapsed ).count() << "\n";
+  print_eliminated( st );
+}
+
+template<typename S> void test_stack_scaling(){
+  for( int splits=1; splits<=16; splits*=2 ){
+    std::cout << "splits: " << splits << "\n";
+    test_stack_2<S>( splits );
+  }
+}
+
+//the freelist use case: BUFFERS buffers, every thread takes one, writes it and gives it back
+template<typename S> void bench_freelist( const char* name, int threads ){
+  S freelist;
+  std::vector< std::vector<char> > buffers( BUFFERS, std::vector<char>( BUFFER_SIZE ) );
+  for( auto& b : buffers ) freelist.push( b.data() );
+
+  error_flag_t err;
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<std::thread> pool;
+  for( int t=0; t<threads; ++t ) pool.emplace_back( [&freelist, &err, threads, t](){
+      char* b;
+      for( int i=0; i<FREELIST_OPS/threads; ++i ){
+        if( !freelist.pop( b ) ){ err.set(); continue; }   //never more threads than buffers
+        std::memset( b, t, 256 );                           //some use of the buffer
+        if( b[255] != char( t ) ) err.set();
+        freelist.push( b );
+      }
+    });
+  for( auto& th : pool ) th.join();
+  auto stop = std::chrono::high_resolution_clock::now();
+
+  std::cout << name << ", " << threads << " threads: " << std::chrono::duration_cast<std::chrono::nanoseconds>( stop - start ).count() / double( FREELIST_OPS )
+            << " ns per take + give back" << ( err.is_set() ? " (failed)" : "" ) << "\n";
+}
+
+/*
+Example (on a 1 vcpu vm, -O2, time in milliseconds):
+
+test_lifo...passed
+****************************** Producers scaling (spin lock + std::vector)
+splits: 1
+test...passed
+elapsed: 40
+splits: 2
+test...passed
+elapsed: 49
+splits: 4
+test...passed
+elapsed: 45
+splits: 8
+test...passed
+elapsed: 43
+splits: 16
+test...passed
+elapsed: 2289
+****************************** Producers scaling (lock-free stack)
+splits: 1
+test...passed
+elapsed: 63
+eliminated: 0
+splits: 2
+test...passed
+elapsed: 60
+eliminated: 0
+splits: 4
+test...passed
+elapsed: 71
+eliminated: 0
+splits: 8
+test...passed
+elapsed: 89
+eliminated: 0
+splits: 16
+test...passed
+elapsed: 105
+eliminated: 0
+****************************** Lock-free stack, always through the elimination array
+test...passed
+elapsed: 290
+eliminated: 23
+****************************** Freelist
+spin lock + std::vector, 1 threads: 24.343 ns per take + give back
+lock-free stack        , 1 threads: 64.4303 ns per take + give back
+spin lock + std::vector, 2 threads: 26.0231 ns per take + give back
+lock-free stack        , 2 threads: 63.6721 ns per take + give back
+spin lock + std::vector, 4 threads: 26.1967 ns per take + give back
+lock-free stack        , 4 threads: 68.5098 ns per take + give back
+spin lock + std::vector, 8 threads: 26.7179 ns per take + give back
+lock-free stack        , 8 threads: 67.7518 ns per take + give back
+spin lock + std::vector, 16 threads: 25.2252 ns per take + give back
+lock-free stack        , 16 threads: 64.3858 ns per take + give back
+
+Without contention the spin lock is cheaper: a lock is one exchange and a store, while a lock-free push or pop is
+two CAS (on top and on the internal list of free nodes), so a take + give back of the freelist is 4 CAS against 2 locks.
+What the lock can't survive is its holder being preempted: everybody else yields until it runs again, hence
+the spikes of the std::vector with 8 - 16 producers and consumers (1 - 2 s here, from run to run), while the lock-free
+stack grows smoothly with the threads. On a single core the CAS on top is never contended, so elimination only happens
+when it is forced (elimination_t::always, where a preempted push left its offer in a slot); on a multi core box the
+contended CASes of the scaling test are where the pairs would be eliminated.
+*/
+
+int main(){
+  test_lifo();
+
+  std::cout << "****************************** Producers scaling (spin lock + std::vector)\n";
+  test_stack_scaling< locked_stack_t<int> >();
+  std::cout << "****************************** Producers scaling (lock-free stack)\n";
+  test_stack_scaling< lock_free_stack_t<int> >();
+  std::cout << "****************************** Lock-free stack, always through the elimination array\n";
+  test_stack_2< lock_free_stack_t<int> >( SPLITS, elimination_t::always );
+
+  std::cout << "****************************** Freelist\n";
+  for( int threads=1; threads<=16; threads*=2 ){
+    bench_freelist< locked_stack_t<char*> >( "spin lock + std::vector", threads );
+    bench_freelist< lock_free_stack_t<char*> >( "lock-free stack        ", threads );
+  }
+  return 0;
+}
@@ -0,0 +1,188 @@
+#ifndef LOCK_FREE_STACK_HPP
+#define LOCK_FREE_STACK_HPP
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <functional>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+#include "cache_line.hpp"
+#include "sharded_counter.hpp"
+
+/*
+Lock-free stack (Treiber) with tagged indices and an elimination array
+
+LIFO is what a freelist wants: the buffer freed last is the one still in the cache.
+
+Treiber: top points to the first node, push = node->next = top; CAS( top, next -> node ), pop = CAS( top, node -> node->next ).
+Two problems:
+- pop reads node->next of a node that another thread may have popped meanwhile: the node must still be readable.
+  The nodes are never deleted while the stack lives, a popped node goes to an internal freelist (itself a Treiber stack)
+  and is reused by a later push: whatever is read from a stale node is only used by a CAS that fails
+- ABA: A is on top, a pop reads A and next = B, and is preempted; others pop A, pop B, push A back.
+  The CAS( top, A -> B ) succeeds and B, which is in use now, is on the stack again.
+  With node reuse (the freelist, and the same for the users' own buffers) this is the normal case, not a corner case.
+  So top is not a pointer but a 32 bit node index and a 32 bit tag in one 64 bit word, and every change bumps the tag:
+  the stale CAS compares an older tag and fails (it would take 2^32 changes during one preemption to wrap around).
+  A 16 byte { pointer, tag } CAS needs cmpxchg16b (and libatomic); 64 bits are lock-free everywhere.
+  (EBR, epoch_reclamation.hpp, would also prevent the ABA, but only by not reusing a node until no thread can see it:
+  exactly the reuse of hot nodes a freelist is for)
+
+The nodes live in chunks of STACK_CHUNK_NODES, allocated when the fresh indices reach them (under a mutex, once per chunk);
+an index finds its node through a fixed table of chunks, so the table never moves. Index 0 is the empty stack.
+
+Elimination (Hendler, Shavit, Yerushalmi - A Scalable Lock-free Stack Algorithm):
+a push and a pop that meet are a no-op on the stack, so they don't need top. When a CAS on top fails (contention),
+a push offers its node in a random slot of an array of ELIMINATION_SLOTS and waits a little (ELIMINATION_SPINS loads);
+a pop that failed its CAS looks at a random slot and takes the node it finds there. Whoever gets no partner goes back
+to top. The slots are tagged too: a push that takes back its offer compares the tag, so an offer that was taken
+(and whose node is offered again) can't be taken back by mistake.
+On one core the CAS on top almost never fails (only when a thread is preempted between the load and the CAS),
+so the array is rarely used; with many cores hammering top it takes pairs away from it.
+elimination_t::always tries the array before top on every push and pop (a push pays up to ELIMINATION_SPINS loads
+when nobody comes): for a top that is known to be hot, and to test the array on a box without contention.
+*/
+
+#define STACK_CHUNK_NODES 4096
+#define STACK_MAX_CHUNKS 4096        //16M nodes
+#define ELIMINATION_SLOTS 16
+#define ELIMINATION_SPINS 128
+
+enum class elimination_t{ on_contention, always };
+
+template<typename T>
+class lock_free_stack_t{
+public:
+  explicit lock_free_stack_t( elimination_t e = elimination_t::on_contention ) : always_{ e == elimination_t::always } {}
+  lock_free_stack_t( lock_free_stack_t const& ) = delete;
+  lock_free_stack_t& operator=( lock_free_stack_t const& ) = delete;
+
+  ~lock_free_stack_t(){
+    for( auto& c : chunks_ ) delete[] c.load( std::memory_order_relaxed );
+  }
+
+  void push( T const& v ){
+    auto i = alloc_node();
+    node( i ).value = v;
+    if( always_ && offer( i ) ){ ++eliminated_; return; }
+    for(;;){
+      if( try_push( items_, i ) ) return;
+      if( offer( i ) ){ ++eliminated_; return; }
+    }
+  }
+
+  //false if the stack is empty
+  bool pop( T& v ){
+    std::uint32_t i;
+    if( always_ && take( i ) ){
+      v = std::move( node( i ).value );
+      free_node( i );
+      return true;
+    }
+    for(;;){
+      auto r = try_pop( items_, i );
+      if( r == was_empty ) return false;
+      if( r == contended && !take( i ) ) continue;
+      v = std::move( node( i ).value );
+      free_node( i );
+      return true;
+    }
+  }
+
+  bool empty() const { return index( items_.load( std::memory_order_acquire ) ) == 0; }
+
+  //push / pop pairs that met in the elimination array
+  long eliminated() const { return eliminated_.read(); }
+
+private:
+  struct node_t{
+    std::atomic<std::uint32_t> next{ 0 };
+    T value{};
+  };
+
+  enum result_t{ popped, was_empty, contended };
+
+  static std::uint32_t index( std::uint64_t top ){ return std::uint32_t( top ); }
+  static std::uint64_t bump( std::uint64_t top, std::uint32_t i ){ return ( ( ( top >> 32 ) + 1 ) << 32 ) | i; }
+
+  node_t& node( std::uint32_t i ){
+    return chunks_[ i / STACK_CHUNK_NODES ].load( std::memory_order_acquire )[ i % STACK_CHUNK_NODES ];
+  }
+
+  //one CAS
+  bool try_push( std::atomic<std::uint64_t>& top, std::uint32_t i ){
+    auto old = top.load( std::memory_order_relaxed );
+    node( i ).next.store( index( old ), std::memory_order_relaxed );
+    return top.compare_exchange_strong( old, bump( old, i ), std::memory_order_release, std::memory_order_relaxed );
+  }
+
+  result_t try_pop( std::atomic<std::uint64_t>& top, std::uint32_t& i ){
+    auto old = top.load( std::memory_order_acquire );
+    i = index( old );
+    if( !i ) return was_empty;
+    auto next = node( i ).next.load( std::memory_order_relaxed );   //stale if i was popped meanwhile: then the CAS fails
+    return top.compare_exchange_strong( old, bump( old, next ), std::memory_order_acquire, std::memory_order_relaxed ) ? popped : contended;
+  }
+
+  std::uint32_t alloc_node(){
+    for(;;){
+      std::uint32_t i;
+      auto r = try_pop( free_, i );
+      if( r == popped ) return i;
+      if( r == was_empty ) break;
+    }
+    auto i = fresh_.fetch_add( 1, std::memory_order_relaxed );
+    auto c = i / STACK_CHUNK_NODES;
+    if( c >= STACK_MAX_CHUNKS ) throw std::bad_alloc();
+    if( !chunks_[c].load( std::memory_order_acquire ) ){
+      std::lock_guard<std::mutex> lock( chunks_mutex_ );
+      if( !chunks_[c].load( std::memory_order_relaxed ) ) chunks_[c].store( new node_t[ STACK_CHUNK_NODES ], std::memory_order_release );
+    }
+    return i;
+  }
+
+  void free_node( std::uint32_t i ){ while( !try_push( free_, i ) ); }
+
+  static std::size_t random_slot(){
+    static thread_local std::uint32_t x = std::uint32_t( std::hash<std::thread::id>()( std::this_thread::get_id() ) ) | 1;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    return x % ELIMINATION_SLOTS;
+  }
+
+  //true if a pop took the node
+  bool offer( std::uint32_t i ){
+    auto& s = slots_[ random_slot() ].state;
+    auto cur = s.load( std::memory_order_relaxed );
+    if( index( cur ) ) return false;                  //somebody else's offer
+    auto mine = ( cur & ~std::uint64_t( 0xFFFFFFFF ) ) | i;
+    if( !s.compare_exchange_strong( cur, mine, std::memory_order_release, std::memory_order_relaxed ) ) return false;
+    for( int k=0; k<ELIMINATION_SPINS; ++k ) if( s.load( std::memory_order_relaxed ) != mine ) return true;
+    return !s.compare_exchange_strong( mine, bump( mine, 0 ), std::memory_order_relaxed );   //take it back, unless it was just taken
+  }
+
+  bool take( std::uint32_t& i ){
+    auto& s = slots_[ random_slot() ].state;
+    auto cur = s.load( std::memory_order_relaxed );
+    i = index( cur );
+    return i && s.compare_exchange_strong( cur, bump( cur, 0 ), std::memory_order_acquire, std::memory_order_relaxed );
+  }
+
+  struct alignas(CACHE_LINE_SIZE) slot_t{
+    std::atomic<std::uint64_t> state{ 0 };   //tag << 32 | offered node
+  };
+
+  alignas(CACHE_LINE_SIZE) std::atomic<std::uint64_t> items_{ 0 };   //tag << 32 | top node
+  alignas(CACHE_LINE_SIZE) std::atomic<std::uint64_t> free_{ 0 };
+  alignas(CACHE_LINE_SIZE) std::atomic<std::uint32_t> fresh_{ 1 };   //the next never used index
+  slot_t slots_[ ELIMINATION_SLOTS ];
+  const bool always_;
+  sharded_counter_t eliminated_;
+  std::mutex chunks_mutex_;
+  std::atomic<node_t*> chunks_[ STACK_MAX_CHUNKS ] = {};
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef MPMC_RING_HPP
+#define MPMC_RING_HPP
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+#include "cache_line.hpp"
+
+/*
+Bounded Many Producers - Many Consumers ring (D. Vyukov's bounded MPMC queue)
+
+The same fixed array as spsc_ring_t, but both ends are shared, so each end is a counter claimed with a CAS
+and each slot has a sequence number that tells whose turn it is:
+
+  seq == pos         the slot is free for the producer that claims pos
+  seq == pos + 1     the slot holds the value for the consumer that claims pos
+  (the consumer sets seq = pos + capacity: free for the producer of the next lap)
+
+A producer (consumer) only claims pos after it saw the slot ready for it, so there is no lock and no ABA on the counters;
+the price over spsc_ring_t is a CAS on a shared cache line per operation.
+try_push / try_pop fail when the ring is full / empty, or (rarely) when the slot is still being filled / emptied
+by a thread that claimed it a lap earlier: retry.
+*/
+
+template<typename T> class mpmc_ring_t{
+private:
+  struct slot_t{
+    std::atomic<std::size_t> seq;
+    T value;
+  };
+
+  std::size_t mask_;
+  std::unique_ptr<slot_t[]> slots_;
+  alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> tail_{ 0 };   //producers
+  alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> head_{ 0 };   //consumers
+  char pad_[ CACHE_LINE_SIZE - sizeof( std::atomic<std::size_t> ) ];
+
+  static std::size_t round_up( std::size_t n ){ std::size_t c = 2; while( c < n ) c <<= 1; return c; }
+
+public:
+  explicit mpmc_ring_t( std::size_t capacity ) : mask_{ round_up( capacity ) - 1 }, slots_{ new slot_t[ mask_ + 1 ] } {
+    for( std::size_t i=0; i<=mask_; ++i ) slots_[i].seq.store( i, std::memory_order_relaxed );
+  }
+
+  mpmc_ring_t( mpmc_ring_t const& ) = delete;
+  mpmc_ring_t& operator=( mpmc_ring_t const& ) = delete;
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+  bool try_push( T const& v ){
+    auto pos = tail_.load( std::memory_order_relaxed );
+    for(;;){
+      auto& s = slots_[ pos & mask_ ];
+      auto seq = s.seq.load( std::memory_order_acquire );
+      auto diff = std::ptrdiff_t( seq - pos );
+      if( diff == 0 ){
+        if( tail_.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ){
+          s.value = v;
+          s.seq.store( pos + 1, std::memory_order_release );
+          return true;
+        }
+      }else if( diff < 0 ){
+        return false;                                          //full
+      }else{
+        pos = tail_.load( std::memory_order_relaxed );         //another producer took it
+      }
+    }
+  }
+
+  bool try_pop( T& v ){
+    auto pos = head_.load( std::memory_order_relaxed );
+    for(;;){
+      auto& s = slots_[ pos & mask_ ];
+      auto seq = s.seq.load( std::memory_order_acquire );
+      auto diff = std::ptrdiff_t( seq - ( pos + 1 ) );
+      if( diff == 0 ){
+        if( head_.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ){
+          v = std::move( s.value );
+          s.seq.store( pos + mask_ + 1, std::memory_order_release );
+          return true;
+        }
+      }else if( diff < 0 ){
+        return false;                                          //empty
+      }else{
+        pos = head_.load( std::memory_order_relaxed );
+      }
+    }
+  }
+
+  //a snapshot
+  std::size_t size() const {
+    auto head = head_.load( std::memory_order_acquire );
+    auto tail = tail_.load( std::memory_order_acquire );
+    return tail > head ? tail - head : 0;
+  }
+};
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef PARALLEL_ALGORITHMS_HPP
+#define PARALLEL_ALGORITHMS_HPP
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <functional>
+#include <cstddef>
+
+#include "thread_pool.hpp"
+
+/*
+Parallel for_each / transform_reduce / sort on a thread_pool_t
+
+The standard parallel algorithms (std::execution::par) need TBB behind libstdc++. These only need the pool:
+
+- the range is cut in chunks of `grain` elements (0: about 8 chunks per thread of the pool, at least MIN_GRAIN elements),
+  each chunk is a task_group_t task and the calling thread helps while it waits
+- a small grain balances better and costs a task (a std::function and a lock on the pool queue) per chunk;
+  a big grain is cheap but the last chunk decides the time
+- parallel_transform_reduce reduces every chunk on its own, then the partial results in chunk order on the caller:
+  the result is the same for the same grain (not bit for bit the same as the serial one for floating point)
+- parallel_sort is a merge sort: std::sort of every chunk in parallel, then rounds of pairwise merges into a buffer
+  (n extra elements). Each merge is itself cut in pieces of about `grain` elements: the longer run is cut in equal parts
+  and the matching cut in the other run is found with a binary search, so the last rounds (one or two huge merges)
+  still use all the threads. Not stable.
+*/
+
+#define MIN_GRAIN 4096
+#define CHUNKS_PER_THREAD 8
+
+inline std::size_t auto_grain( thread_pool_t& pool, std::size_t n, std::size_t grain ){
+  if( grain ) return grain;
+  auto g = n / ( std::size_t( pool.size() + 1 ) * CHUNKS_PER_THREAD );
+  return g < MIN_GRAIN ? MIN_GRAIN : g;
+}
+
+//f( i ) for i in [first, last)
+template<typename F> void parallel_for( thread_pool_t& pool, std::size_t first, std::size_t last, F f, std::size_t grain = 0 ){
+  if( first >= last ) return;
+  grain = auto_grain( pool, last - first, grain );
+  task_group_t g( pool );
+  for( auto b = first; b < last; b += grain ){
+    auto e = last - b > grain ? b + grain : last;
+    if( e == last ){ for( auto i = b; i < e; ++i ) f( i ); }   //the last chunk on the calling thread
+    else g.run( [b, e, &f](){ for( auto i = b; i < e; ++i ) f( i ); } );
+  }
+  g.wait();
+}
+
+//f( x ) for every element
+template<typename It, typename F> void parallel_for_each( thread_pool_t& pool, It first, It last, F f, std::size_t grain = 0 ){
+  parallel_for( pool, 0, std::size_t( last - first ), [first, &f]( std::size_t i ){ f( first[ i ] ); }, grain );
+}
+
+//reduce( init, transform( x )... ): reduce must be associative
+template<typename It, typename T, typename R, typename X> T parallel_transform_reduce( thread_pool_t& pool, It first, It last, T init, R reduce, X transform, std::size_t grain = 0 ){
+  auto n = std::size_t( last - first );
+  if( !n ) return init;
+  grain = auto_grain( pool, n, grain );
+  auto chunks = ( n + grain - 1 ) / grain;
+  std::vector<T> partial( chunks );
+  parallel_for( pool, 0, chunks, [&]( std::size_t c ){
+      auto b = first + c * grain, e = first + std::min( n, ( c + 1 ) * grain );
+      T acc = transform( *b );
+      for( ++b; b != e; ++b ) acc = reduce( acc, transform( *b ) );
+      partial[c] = acc;
+    }, 1 );
+  for( auto& p : partial ) init = reduce( init, p );
+  return init;
+}
+
+//merges [a, a_end) and [b, b_end) into out, in pieces of about grain elements
+template<typename It, typename Out, typename C> void parallel_merge( thread_pool_t& pool, It a, It a_end, It b, It b_end, Out out, C comp, std::size_t grain ){
+  auto na = std::size_t( a_end - a ), nb = std::size_t( b_end - b );
+  auto pieces = ( na + nb ) / grain + 1;
+  if( pieces == 1 ){ std::merge( std::make_move_iterator( a ), std::make_move_iterator( a_end ), std::make_move_iterator( b ), std::make_move_iterator( b_end ), out, comp ); return; }
+
+  //the cuts: the longer run in equal parts, the shorter one where the same values are
+  //(ties: what is equal in a goes before, like in std::merge)
+  std::vector<std::size_t> ca( pieces + 1 ), cb( pieces + 1 );
+  ca[0] = cb[0] = 0; ca[ pieces ] = na; cb[ pieces ] = nb;
+  for( std::size_t k=1; k<pieces; ++k ){
+    if( na >= nb ){
+      ca[k] = k * na / pieces;
+      cb[k] = ca[k] < na ? std::size_t( std::lower_bound( b, b_end, a[ ca[k] ], comp ) - b ) : nb;
+    }else{
+      cb[k] = k * nb / pieces;
+      ca[k] = cb[k] < nb ? std::size_t( std::upper_bound( a, a_end, b[ cb[k] ], comp ) - a ) : na;
+    }
+  }
+  parallel_for( pool, 0, pieces, [&]( std::size_t k ){
+      std::merge( std::make_move_iterator( a + ca[k] ), std::make_move_iterator( a + ca[k+1] ),
+                  std::make_move_iterator( b + cb[k] ), std::make_move_iterator( b + cb[k+1] ), out + ( ca[k] + cb[k] ), comp );
+    }, 1 );
+}
+
+template<typename It, typename C = std::less<>> void parallel_sort( thread_pool_t& pool, It first, It last, C comp = C{}, std::size_t grain = 0 ){
+  using T = typename std::iterator_traits<It>::value_type;
+  auto n = std::size_t( last - first );
+  if( n < 2 ) return;
+  grain = auto_grain( pool, n, grain );
+
+  //sorted runs of grain elements
+  std::vector<std::size_t> runs;
+  for( std::size_t b = 0; b < n; b += grain ) runs.push_back( b );
+  runs.push_back( n );
+  parallel_for( pool, 0, runs.size() - 1, [&]( std::size_t r ){ std::sort( first + runs[r], first + runs[r+1], comp ); }, 1 );
+  if( runs.size() == 2 ) return;
+
+  //merge rounds, back and forth between the range and the buffer
+  std::vector<T> buffer( n );
+  bool in_buffer = false;
+  while( runs.size() > 2 ){
+    std::vector<std::size_t> merged;
+    std::size_t pairs = ( runs.size() - 1 ) / 2;
+    for( std::size_t p = 0; p < pairs; ++p ) merged.push_back( runs[ 2*p ] );
+    if( ( runs.size() - 1 ) % 2 ) merged.push_back( runs[ runs.size() - 2 ] );   //the odd one is copied
+    merged.push_back( n );
+
+    auto step = [&]( auto src, auto dst ){
+      task_group_t g( pool );
+      for( std::size_t p = 0; p < pairs; ++p )
+        g.run( [&, p](){ parallel_merge( pool, src + runs[ 2*p ], src + runs[ 2*p+1 ], src + runs[ 2*p+1 ], src + runs[ 2*p+2 ], dst + runs[ 2*p ], comp, grain ); } );
+      if( ( runs.size() - 1 ) % 2 ){
+        auto b = runs[ runs.size() - 2 ];
+        parallel_for( pool, b, n, [&]( std::size_t i ){ dst[i] = std::move( src[i] ); }, grain );
+      }
+      g.wait();
+    };
+    if( in_buffer ) step( buffer.begin(), first ); else step( first, buffer.begin() );
+    in_buffer = !in_buffer;
+    runs.swap( merged );
+  }
+  if( in_buffer ) parallel_for( pool, 0, n, [&]( std::size_t i ){ first[i] = std::move( buffer[i] ); }, grain );
+}
+
+#endif
@@ -0,0 +1,80 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <chrono>
+
+#include "sharded_counter.hpp"
+
+//Compile: g++ sharded_counter.cpp -std=c++11 -O2 -lpthread
+
+#define INCREMENTS 10000000
+
+template<typename F> void on_threads( int threads, F f ){
+  std::vector<std::thread> pool;
+  for( int t=0; t<threads; ++t ) pool.emplace_back( [&f, t](){ f( t ); } );
+  for( auto& th : pool ) th.join();
+}
+
+void test_sharded(){
+  bool err = false;
+  for( int threads : { 1, 4, 100 } ){   //100: more threads than shards, some of them share a cell
+    sharded_counter_t c;
+    sharded_stats_t s;
+    error_flag_t e;
+    on_threads( threads, [&c, &s, &e]( int t ){
+        for( int i=0; i<10000; ++i ){ ++c; s.add( t * 10000 + i ); }
+        if( t == 3 ) e.set();
+      });
+    auto snap = s.read();
+    long long n = 10000LL * threads;
+    if( c.read() != n || snap.count != n || snap.sum != n * ( n - 1 ) / 2 || snap.min != 0 || snap.max != n - 1 ) err = true;
+    if( e.is_set() != ( threads > 3 ) ) err = true;
+    c.reset();
+    s.reset();
+    if( c.read() != 0 || s.read().count != 0 ) err = true;
+  }
+  std::cout << "test_sharded..." << ( err ? "failed" : "passed" ) << "\n";
+}
+
+template<typename C> void bench( const char* name, int threads ){
+  C c;
+  auto start = std::chrono::high_resolution_clock::now();
+  on_threads( threads, [&c, threads]( int ){ for( int i=0; i<INCREMENTS/threads; ++i ) ++c; } );
+  auto stop = std::chrono::high_resolution_clock::now();
+  std::cout << name << ", " << threads << " threads: " << std::chrono::duration_cast<std::chrono::nanoseconds>( stop - start ).count() / double( INCREMENTS ) << " ns per increment\n";
+}
+
+void bench_counters(){
+  for( int threads=1; threads<=16; threads*=2 ){
+    bench< std::atomic<long> >( "std::atomic<long>", threads );
+    bench< sharded_counter_t >( "sharded_counter_t", threads );
+  }
+}
+
+/*
+Example (on a 1 vcpu vm, -O2):
+
+test_sharded...passed
+std::atomic<long>, 1 threads: 11.6018 ns per increment
+sharded_counter_t, 1 threads: 10.9961 ns per increment
+std::atomic<long>, 2 threads: 10.9283 ns per increment
+sharded_counter_t, 2 threads: 11.7146 ns per increment
+std::atomic<long>, 4 threads: 11.443 ns per increment
+sharded_counter_t, 4 threads: 10.8866 ns per increment
+std::atomic<long>, 8 threads: 9.8223 ns per increment
+sharded_counter_t, 8 threads: 11.2749 ns per increment
+std::atomic<long>, 16 threads: 11.6737 ns per increment
+sharded_counter_t, 16 threads: 11.5447 ns per increment
+
+With one core the cache line never moves, so both are the cost of a locked add (the lookup of the shard is free).
+On a multi core box the std::atomic line bounces between the cores and its cost per increment grows with the threads
+(not measurable here), while every shard stays in its own core's cache.
+The same goes for test_concurrent_queue_2: on one core it runs as fast as with the shared idx.
+*/
+
+int main(){
+  test_sharded();
+  bench_counters();
+  return 0;
+}
@@ -0,0 +1,115 @@
+#ifndef SHARDED_COUNTER_HPP
+#define SHARDED_COUNTER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <climits>
+
+#include "cache_line.hpp"
+
+/*
+Sharded counters, statistics and a race free error flag
+
+A single std::atomic<long> that every thread increments (idx++ in test_concurrent_queue_2, a request counter) is one cache line
+that moves from core to core on every increment: the increments of all the threads are serialized on it.
+Most of the time nobody reads the total while it is being counted, so:
+
+- the counter is COUNTER_SHARDS cells, each one alone on its cache line
+- a thread always adds to the same cell (the threads are given cells round robin the first time they count),
+  so with up to COUNTER_SHARDS threads a cell is never shared and the add stays in the thread's own cache
+  (it is still an atomic add: with more threads than cells two threads share a cell, and that is still correct)
+- read() adds the cells up: COUNTER_SHARDS loads, exact once the writers are done, a moment's total while they run
+
+sharded_stats_t is the same for samples (latencies, sizes): count, sum, min and max per cell; read() merges them
+(the fields of a snapshot taken while writers run may come from slightly different moments).
+
+error_flag_t replaces the plain bool err that several test threads write: a data race (undefined behaviour,
+and the compiler may keep it in a register). set() only writes when the flag is not set yet, so a thread that keeps
+finding errors does not keep bouncing the cache line.
+*/
+
+#define COUNTER_SHARDS 64
+
+//the cell of the calling thread (the same for every sharded counter)
+inline std::size_t this_thread_shard(){
+  static std::atomic<std::size_t> next{ 0 };
+  thread_local std::size_t shard = next.fetch_add( 1, std::memory_order_relaxed ) % COUNTER_SHARDS;
+  return shard;
+}
+
+class sharded_counter_t{
+public:
+  void add( long n = 1 ){ cells_[ this_thread_shard() ].value.fetch_add( n, std::memory_order_relaxed ); }
+  sharded_counter_t& operator++(){ add( 1 ); return *this; }
+
+  long read() const {
+    long n = 0;
+    for( auto& c : cells_ ) n += c.value.load( std::memory_order_relaxed );
+    return n;
+  }
+
+  void reset(){ for( auto& c : cells_ ) c.value.store( 0, std::memory_order_relaxed ); }
+
+private:
+  struct alignas(CACHE_LINE_SIZE) cell_t{
+    std::atomic<long> value{ 0 };
+  };
+  cell_t cells_[ COUNTER_SHARDS ];
+};
+
+class sharded_stats_t{
+public:
+  struct snapshot_t{
+    long long count, sum, min, max;
+    double mean() const { return count ? double( sum ) / count : 0.0; }
+  };
+
+  void add( long long x ){
+    auto& c = cells_[ this_thread_shard() ];
+    c.count.fetch_add( 1, std::memory_order_relaxed );
+    c.sum.fetch_add( x, std::memory_order_relaxed );
+    auto m = c.min.load( std::memory_order_relaxed );
+    while( x < m && !c.min.compare_exchange_weak( m, x, std::memory_order_relaxed ) );
+    m = c.max.load( std::memory_order_relaxed );
+    while( x > m && !c.max.compare_exchange_weak( m, x, std::memory_order_relaxed ) );
+  }
+
+  //min / max are LLONG_MAX / LLONG_MIN while count is 0
+  snapshot_t read() const {
+    snapshot_t s{ 0, 0, LLONG_MAX, LLONG_MIN };
+    for( auto& c : cells_ ){
+      s.count += c.count.load( std::memory_order_relaxed );
+      s.sum += c.sum.load( std::memory_order_relaxed );
+      auto mn = c.min.load( std::memory_order_relaxed ), mx = c.max.load( std::memory_order_relaxed );
+      if( mn < s.min ) s.min = mn;
+      if( mx > s.max ) s.max = mx;
+    }
+    return s;
+  }
+
+  void reset(){
+    for( auto& c : cells_ ){
+      c.count.store( 0, std::memory_order_relaxed );
+      c.sum.store( 0, std::memory_order_relaxed );
+      c.min.store( LLONG_MAX, std::memory_order_relaxed );
+      c.max.store( LLONG_MIN, std::memory_order_relaxed );
+    }
+  }
+
+private:
+  struct alignas(CACHE_LINE_SIZE) cell_t{
+    std::atomic<long long> count{ 0 }, sum{ 0 }, min{ LLONG_MAX }, max{ LLONG_MIN };
+  };
+  cell_t cells_[ COUNTER_SHARDS ];
+};
+
+class error_flag_t{
+public:
+  void set(){ if( !set_.load( std::memory_order_relaxed ) ) set_.store( true, std::memory_order_release ); }
+  bool is_set() const { return set_.load( std::memory_order_acquire ); }
+
+private:
+  std::atomic<bool> set_{ false };
+};
+
+#endif
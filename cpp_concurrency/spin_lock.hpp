@@ -0,0 +1,23 @@
+#ifndef SPIN_LOCK_HPP
+#define SPIN_LOCK_HPP
+
+#include <atomic>
+#include <thread>
+
+#include "cache_line.hpp"
+
+struct alignas(CACHE_LINE_SIZE) spin_lock_t{
+  std::atomic_flag flag;
+
+  spin_lock_t() : flag( ATOMIC_FLAG_INIT ) {}
+
+  //spin + yield seems to improve the performance...
+  void lock(){ while( flag.test_and_set( std::memory_order_acquire ) ){ std::this_thread::yield(); }; }
+  //void lock(){ while( flag.test_and_set( std::memory_order_acquire ) ); }
+
+  bool try_lock(){ return !flag.test_and_set( std::memory_order_acquire ); }
+
+  void unlock(){ flag.clear( std::memory_order_release ); }
+};
+
+#endif
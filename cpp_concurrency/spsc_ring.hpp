@@ -0,0 +1,93 @@
+#ifndef SPSC_RING_HPP
+#define SPSC_RING_HPP
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+#include "cache_line.hpp"
+
+/*
+Bounded One Producer - One Consumer ring
+
+lock_free_queue_t (lock_free_queue_and_general_concurrent_queue.cpp) is a linked list: one allocation per push
+and it never says "full". For a hot path that must never block (logging, metrics) we want the opposite:
+a fixed array allocated once, and a push that fails immediately when the consumer is behind.
+
+  head (consumer)                tail (producer)
+   |                              |
+  [ x ][ x ][ x ][ x ][ x ][ x ][   ][   ]      capacity is a power of two, slot = index & mask
+
+- tail_ is written only by the producer, head_ only by the consumer (release), each reads the other one (acquire)
+- each side keeps a private copy of the other side's index and only reloads it when the ring looks full / empty,
+  so in the common case a push or a pop touches no shared cache line except the slot
+- consume( f ) hands the consumer everything available in one go: f( T& ) on each slot in place, then ONE store of head_
+*/
+
+template<typename T> class spsc_ring_t{
+private:
+  struct alignas(CACHE_LINE_SIZE) producer_t{
+    std::atomic<std::size_t> tail{ 0 };
+    std::size_t head_cache = 0;
+  };
+
+  struct alignas(CACHE_LINE_SIZE) consumer_t{
+    std::atomic<std::size_t> head{ 0 };
+    std::size_t tail_cache = 0;
+  };
+
+  producer_t p_;
+  consumer_t c_;
+  std::size_t mask_;
+  std::unique_ptr<T[]> slots_;
+
+  static std::size_t round_up( std::size_t n ){ std::size_t c = 2; while( c < n ) c <<= 1; return c; }
+
+public:
+  explicit spsc_ring_t( std::size_t capacity ) : mask_{ round_up( capacity ) - 1 }, slots_{ new T[ mask_ + 1 ] } {}
+
+  spsc_ring_t( spsc_ring_t const& ) = delete;
+  spsc_ring_t& operator=( spsc_ring_t const& ) = delete;
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+  //producer only; false if the ring is full
+  bool try_push( T const& v ){
+    auto tail = p_.tail.load( std::memory_order_relaxed );
+    if( tail - p_.head_cache > mask_ ){
+      p_.head_cache = c_.head.load( std::memory_order_acquire );
+      if( tail - p_.head_cache > mask_ ) return false;
+    }
+    slots_[ tail & mask_ ] = v;
+    p_.tail.store( tail + 1, std::memory_order_release );
+    return true;
+  }
+
+  //consumer only; false if the ring is empty
+  bool try_pop( T& v ){
+    auto head = c_.head.load( std::memory_order_relaxed );
+    if( head == c_.tail_cache ){
+      c_.tail_cache = p_.tail.load( std::memory_order_acquire );
+      if( head == c_.tail_cache ) return false;
+    }
+    v = std::move( slots_[ head & mask_ ] );
+    c_.head.store( head + 1, std::memory_order_release );
+    return true;
+  }
+
+  //consumer only: f( T& ) on up to max available items, in place; returns how many
+  template<typename F> std::size_t consume( F&& f, std::size_t max = std::size_t(-1) ){
+    auto head = c_.head.load( std::memory_order_relaxed );
+    c_.tail_cache = p_.tail.load( std::memory_order_acquire );
+    std::size_t n = c_.tail_cache - head;
+    if( n > max ) n = max;
+    for( std::size_t i=0; i<n; ++i ) f( slots_[ ( head + i ) & mask_ ] );
+    if( n ) c_.head.store( head + n, std::memory_order_release );
+    return n;
+  }
+
+  //a snapshot, exact only when called by the producer or the consumer while the other side is idle
+  std::size_t size() const { return p_.tail.load( std::memory_order_acquire ) - c_.head.load( std::memory_order_acquire ); }
+};
+
+#endif
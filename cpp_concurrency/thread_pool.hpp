@@ -0,0 +1,113 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <atomic>
+
+/*
+A fixed pool of worker threads and one FIFO of tasks (the concurrent_queue of waiting_for_a_condition_with_condition_variables.cpp,
+with a stop flag)
+
+- submit( f ) queues f and wakes one worker; the tasks must not block waiting for each other
+  (a pool of n threads deadlocks as soon as n tasks wait for a task that is still in the queue)
+- run_one() runs a queued task on the calling thread: a thread that waits for tasks can help instead of sleeping
+- the destructor runs what is still queued, then joins the workers
+
+task_group_t is fork / join on top of it: run( f ) submits f, wait() returns when all of them are done.
+wait() helps (run_one) instead of sleeping, so a task may fork and wait itself (a recursive algorithm on a small pool)
+without taking a worker away.
+*/
+
+class thread_pool_t{
+public:
+  explicit thread_pool_t( unsigned threads = std::thread::hardware_concurrency() ){
+    if( !threads ) threads = 1;
+    for( unsigned i=0; i<threads; ++i ) workers_.emplace_back( [this](){ work(); } );
+  }
+
+  ~thread_pool_t(){
+    {
+      std::lock_guard<std::mutex> lk{ m_ };
+      stop_ = true;
+    }
+    c_.notify_all();
+    for( auto& w : workers_ ) w.join();
+  }
+
+  thread_pool_t( thread_pool_t const& ) = delete;
+  thread_pool_t& operator=( thread_pool_t const& ) = delete;
+
+  template<typename F> void submit( F&& f ){
+    {
+      std::lock_guard<std::mutex> lk{ m_ };
+      q_.emplace_back( std::forward<F>( f ) );
+    }
+    c_.notify_one();
+  }
+
+  //false if there was nothing to run
+  bool run_one(){
+    std::unique_lock<std::mutex> lk{ m_ };
+    if( q_.empty() ) return false;
+    auto task = std::move( q_.front() );
+    q_.pop_front();
+    lk.unlock();
+    task();
+    return true;
+  }
+
+  unsigned size() const { return unsigned( workers_.size() ); }
+
+private:
+  void work(){
+    for(;;){
+      std::unique_lock<std::mutex> lk{ m_ };
+      c_.wait( lk, [this](){ return stop_ || !q_.empty(); } );
+      if( q_.empty() ) return;   //stop_ and nothing left
+      auto task = std::move( q_.front() );
+      q_.pop_front();
+      lk.unlock();
+      task();
+    }
+  }
+
+  std::mutex m_;
+  std::condition_variable c_;
+  std::deque< std::function<void()> > q_;
+  bool stop_ = false;
+  std::vector<std::thread> workers_;   //the last member: the workers start when the rest is ready
+};
+
+//the tasks must not throw
+class task_group_t{
+public:
+  explicit task_group_t( thread_pool_t& pool ) : pool_{ pool } {}
+  ~task_group_t(){ wait(); }
+
+  task_group_t( task_group_t const& ) = delete;
+  task_group_t& operator=( task_group_t const& ) = delete;
+
+  template<typename F> void run( F f ){
+    pending_.fetch_add( 1, std::memory_order_relaxed );
+    pool_.submit( [this, f]() mutable {
+        f();
+        pending_.fetch_sub( 1, std::memory_order_release );   //the last use of this: wait() may return and the group go away
+      });
+  }
+
+  void wait(){
+    while( pending_.load( std::memory_order_acquire ) )
+      if( !pool_.run_one() ) std::this_thread::yield();
+  }
+
+private:
+  thread_pool_t& pool_;
+  std::atomic<std::size_t> pending_{ 0 };
+};
+
+#endif
@@ -133,6 +133,7 @@ void test_multiple_copies_of_shared_future(){
   std::thread t1( [sf](){ sf.get(); } ); //t1 owns a copy
   std::thread t2( [sf](){ sf.get(); } ); //t2 owns another copy
   // but all threads can receive the result of that promise... and no explicit synchronization needed
+  // (once: for a stream of values to several threads see broadcast_ring.hpp)
 
   p.set_value();
 
@@ -0,0 +1,158 @@
+#ifndef WORKLOAD_GENERATOR_HPP
+#define WORKLOAD_GENERATOR_HPP
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+/*
+Workload generator for the cache benchmarks
+
+Looking up 1..N in order (like test1/test2 in avoid_data_races.cpp) is the best case for any cache and any lock:
+the hardware prefetcher sees it coming and all readers walk the same path at the same time.
+Real traffic is skewed (a few keys are very hot) and random, and it mixes reads with writes.
+
+So a workload describes:
+- the key distribution: uniform, zipf (P(rank k) ~ 1/k^s) or hotspot (hot_fraction of the keys get hot_probability of the ops)
+- the read/write mix and the number of threads
+
+The whole trace is generated up front into one flat array (thread t owns the slice [t*ops_per_thread, (t+1)*ops_per_thread)),
+so the generation cost (and the random generators) stay out of the timed region.
+Then run_trace starts all the threads together and times only the replay.
+
+Usage:
+  workload_t w; w.distribution = workload_t::zipf; w.read_ratio = 0.95; w.threads = 4;
+  auto trace = generate_trace( w );
+  auto r = run_trace( trace, [&c]( op_t const& op ){ return op.write ? (c.add( op.key ), false) : c.contains( op.key ); } );
+  report( r, err );
+*/
+
+struct workload_t{
+  enum distribution_t { uniform, zipf, hotspot };
+
+  distribution_t distribution = uniform;
+  int keys = 1000000;              //keys are 0..keys-1
+  double zipf_s = 0.99;            //zipf skew
+  double hot_fraction = 0.01;      //hotspot: this fraction of the keys...
+  double hot_probability = 0.9;    //...gets this fraction of the ops
+  double read_ratio = 0.9;
+  int threads = 4;
+  int ops_per_thread = 1000000;
+  unsigned seed = 1;
+};
+
+struct op_t{
+  int key;
+  bool write;
+};
+
+struct trace_t{
+  std::vector<op_t> ops;
+  int threads;
+  int ops_per_thread;
+
+  op_t const* begin( int t ) const { return ops.data() + std::size_t(t) * ops_per_thread; }
+  op_t const* end( int t ) const { return begin( t ) + ops_per_thread; }
+};
+
+class zipf_distribution_t{
+private:
+  std::vector<double> cdf_;
+
+public:
+  zipf_distribution_t( int n, double s ) : cdf_( n ){
+    double sum = 0;
+    for( int k=1; k<=n; ++k ){ sum += 1.0 / std::pow( k, s ); cdf_[k-1] = sum; }
+    for( auto& c : cdf_ ) c /= sum;
+  }
+
+  //rank in 0..n-1 (0 is the hottest)
+  template<typename G> int operator()( G& g ) const {
+    double u = std::uniform_real_distribution<double>( 0.0, 1.0 )( g );
+    return std::min( int( std::lower_bound( cdf_.begin(), cdf_.end(), u ) - cdf_.begin() ), int( cdf_.size() ) - 1 );
+  }
+};
+
+inline const char* to_string( workload_t::distribution_t d ){
+  switch( d ){
+    case workload_t::uniform: return "uniform";
+    case workload_t::zipf:    return "zipf";
+    case workload_t::hotspot: return "hotspot";
+  }
+  return "?";
+}
+
+inline trace_t generate_trace( workload_t const& w ){
+  trace_t trace{ std::vector<op_t>( std::size_t(w.threads) * w.ops_per_thread ), w.threads, w.ops_per_thread };
+
+  //the hot ranks are scattered over the key space (otherwise the hot keys would also be the small, neighbouring ones)
+  std::vector<int> scatter( w.keys );
+  for( int k=0; k<w.keys; ++k ) scatter[k] = k;
+  std::shuffle( scatter.begin(), scatter.end(), std::mt19937_64( w.seed ) );
+
+  zipf_distribution_t zipf( w.distribution == workload_t::zipf ? w.keys : 1, w.zipf_s );
+  int hot_keys = std::max( 1, int( w.keys * w.hot_fraction ) );
+
+  std::mt19937_64 g( w.seed + 1 );
+  std::uniform_int_distribution<int> any_key( 0, w.keys-1 ), hot_key( 0, hot_keys-1 ), cold_key( hot_keys < w.keys ? hot_keys : 0, w.keys-1 );
+  std::uniform_real_distribution<double> coin( 0.0, 1.0 );
+
+  for( auto& op : trace.ops ){
+    int rank = 0;
+    switch( w.distribution ){
+      case workload_t::uniform: rank = any_key( g ); break;
+      case workload_t::zipf:    rank = zipf( g ); break;
+      case workload_t::hotspot: rank = coin( g ) < w.hot_probability ? hot_key( g ) : cold_key( g ); break;
+    }
+    op.key = scatter[ rank ];
+    op.write = coin( g ) >= w.read_ratio;
+  }
+
+  return trace;
+}
+
+struct run_result_t{
+  std::chrono::high_resolution_clock::duration elapsed;
+  long hits;
+  long ops;
+};
+
+//replays the trace, one thread per slice; f( op_t const& ) returns true on a hit
+template<typename F> run_result_t run_trace( trace_t const& trace, F f ){
+  std::atomic<bool> go {false};
+  std::atomic<long> hits {0};
+
+  std::vector<std::thread> pool;
+  for( int t=0; t<trace.threads; ++t ){
+    pool.emplace_back( [&trace, &go, &hits, &f, t](){
+        while( !go ) std::this_thread::yield();   //everybody starts together
+        long h = 0;
+        for( auto op = trace.begin( t ); op != trace.end( t ); ++op ){
+          if( f( *op ) ) ++h;
+        }
+        hits += h;
+      });
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+  go = true;
+  for( auto& th : pool ) th.join();
+  auto stop = std::chrono::high_resolution_clock::now();
+
+  return run_result_t{ stop - start, hits, long( trace.ops.size() ) };
+}
+
+inline void report( run_result_t const& r, bool err ){
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>( r.elapsed ).count();
+  std::cout << "test..." << ( err ? "failed" : "passed" ) << "\n";
+  std::cout << "elapsed: " << ms << "\n";
+  std::cout << "hit ratio: " << double( r.hits ) / r.ops << "\n";
+  std::cout << "ops/sec: " << ( ms ? r.ops * 1000 / ms : 0 ) << "\n";
+}
+
+#endif
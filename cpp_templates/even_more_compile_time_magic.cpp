@@ -0,0 +1,432 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+
+#include "json_writer.hpp"
+#include "fluent_syntax.hpp"
+#include "fixed_string.hpp"
+
+//Compile: g++ even_more_compile_time_magic.cpp -std=c++20 -O2
+
+/*
+Precomputed JSON skeletons
+
+In fluent_syntax_impl<S, closure, depth, hist> (fluent_syntax.hpp) the shape of the document is part of the type,
+but the backend still rebuilds all of it at runtime: the "first" flag decides every comma, every key is quoted (and scanned
+for escapes) again for every document.
+
+Here the keys are template arguments (fixed_string.hpp, C++20 class type non type template parameters), so each step of the chain
+appends its literal text to a compile time string instead of writing it:
+
+  .begin()                            {
+  .begin_object<"metrics">()          "metrics":{
+  .add_entry<"ts">( ts )              "ts":           + a hole for ts
+  .add_entry<"cpu">( cpu )            ,"cpu":         + a hole for cpu
+  .end_object()                       }
+  .end()                              }
+
+The comma is decided at compile time too (the "first" flag is a template parameter), so the type of the last step holds
+the whole skeleton: the literal segments between the holes and the values to splice in (in a tuple).
+end() reserves the worst case size once and then it is one memcpy (of a constant size) per segment + to_chars / an escaped
+copy per value. A document with only literal values is a single memcpy; the earthling (the two names are runtime values)
+is three memcpys and two escaped copies.
+
+Values:
+  add_entry<"key">( v ) / add_entry( v )                  runtime value: numbers (to_chars), bool, nullptr, strings (escaped at runtime)
+  add_entry<"key", "value">() / add_entry<"value">()      literal value, escaped and merged into the skeleton at compile time
+
+The runtime values are kept by value (numbers) or as std::string_view (strings): the chain is one full expression,
+so a temporary std::string passed to add_entry lives until end() returns.
+
+The output is the same JSON as json_writer_t (json_writer.hpp) and is appended to a json_buffer_t.
+*/
+
+//-- compile time escaping (the same rules as json_writer_t::write_string)
+
+constexpr std::size_t quoted_size( std::string_view s ){
+  std::size_t n = 2;
+  for( unsigned char c : s ){
+    if( c == '"' || c == '\\' || c == '\n' || c == '\r' || c == '\t' ) n += 2;
+    else if( c < 0x20 ) n += 6;
+    else n += 1;
+  }
+  return n;
+}
+
+template<fixed_string S> constexpr auto quoted(){
+  const char hex[] = "0123456789abcdef";
+  fixed_string< quoted_size( S.view() ) > r;
+  std::size_t n = 0;
+  r.data[n++] = '"';
+  for( unsigned char c : S.view() ){
+    switch( c ){
+      case '"':  r.data[n++] = '\\'; r.data[n++] = '"'; break;
+      case '\\': r.data[n++] = '\\'; r.data[n++] = '\\'; break;
+      case '\n': r.data[n++] = '\\'; r.data[n++] = 'n'; break;
+      case '\r': r.data[n++] = '\\'; r.data[n++] = 'r'; break;
+      case '\t': r.data[n++] = '\\'; r.data[n++] = 't'; break;
+      default:
+        if( c < 0x20 ){
+          r.data[n++] = '\\'; r.data[n++] = 'u'; r.data[n++] = '0'; r.data[n++] = '0';
+          r.data[n++] = hex[ c >> 4 ]; r.data[n++] = hex[ c & 15 ];
+        }else{
+          r.data[n++] = char( c );
+        }
+    }
+  }
+  r.data[n++] = '"';
+  return r;
+}
+
+template<bool first, fixed_string L> constexpr auto separated(){
+  if constexpr( first ) return L;
+  else return fixed_string( "," ) + L;
+}
+
+//-- runtime values
+
+//numbers, bool and null are kept as they are, everything else as a string_view (is_json_value is in json_writer.hpp)
+template<typename V> using json_value_t =
+  std::conditional_t< is_json_number<V> || std::is_same<V, bool>::value || std::is_same<V, std::nullptr_t>::value, V, std::string_view >;
+
+#define MAX_NUMBER_SIZE 32
+
+inline std::size_t json_max_size( std::string_view s ){ return 6*s.size() + 2; }  //every character as \u00XX + the quotes
+template<typename N> std::size_t json_max_size( N ){ return MAX_NUMBER_SIZE; }
+
+inline char* json_put( char* p, std::string_view s ){
+  static const char hex[] = "0123456789abcdef";
+  *p++ = '"';
+  std::size_t run = 0;
+  for( std::size_t i=0; i<s.size(); ++i ){
+    auto c = static_cast<unsigned char>( s[i] );
+    if( !needs_escape[c] ) continue;
+    std::memcpy( p, s.data() + run, i - run );  //the run that needs no escaping
+    p += i - run;
+    run = i + 1;
+    *p++ = '\\';
+    switch( c ){
+      case '"':  *p++ = '"'; break;
+      case '\\': *p++ = '\\'; break;
+      case '\n': *p++ = 'n'; break;
+      case '\r': *p++ = 'r'; break;
+      case '\t': *p++ = 't'; break;
+      default: *p++ = 'u'; *p++ = '0'; *p++ = '0'; *p++ = hex[ c >> 4 ]; *p++ = hex[ c & 15 ];
+    }
+  }
+  std::memcpy( p, s.data() + run, s.size() - run );
+  p += s.size() - run;
+  *p++ = '"';
+  return p;
+}
+
+inline char* json_put( char* p, bool v ){ return v ? ( std::memcpy( p, "true", 4 ), p + 4 ) : ( std::memcpy( p, "false", 5 ), p + 5 ); }
+inline char* json_put( char* p, std::nullptr_t ){ std::memcpy( p, "null", 4 ); return p + 4; }
+
+template<typename N, typename = std::enable_if_t< is_json_number<N> >> char* json_put( char* p, N v ){ return json_number( p, p + MAX_NUMBER_SIZE, v ); }
+
+//-- the skeleton: Pending is the literal text after the last hole, Closed... the segments before each hole
+
+template<fixed_string Pending, fixed_string... Closed> struct skeleton{
+  template<fixed_string L> using append = skeleton< Pending + L, Closed... >;
+  using hole = skeleton< fixed_string<0>{}, Closed..., Pending >;
+
+  template<typename... Vs> static std::string_view write( json_buffer_t& buf, std::tuple<Vs...> const& values ){
+    static_assert( sizeof...(Vs) == sizeof...(Closed), "one value per hole" );
+
+    constexpr std::size_t literal_size = ( Pending.size() + ... + Closed.size() );
+    std::size_t size = buf.size_ + literal_size + std::apply( []( auto const&... v ){ return ( std::size_t(0) + ... + json_max_size( v ) ); }, values );
+    buf.reserve( size );
+
+    char* p = buf.data_.get() + buf.size_;
+    p = splice( p, values, std::index_sequence_for<Vs...>{} );
+    std::memcpy( p, Pending.data, Pending.size() );
+    p += Pending.size();
+
+    buf.size_ = p - buf.data_.get();
+    return buf.view();
+  }
+
+private:
+  template<typename Tuple, std::size_t... I> static char* splice( char* p, Tuple const& values, std::index_sequence<I...> ){
+    ( ( std::memcpy( p, Closed.data, Closed.size() ), p += Closed.size(), p = json_put( p, std::get<I>( values ) ) ), ... );
+    return p;
+  }
+};
+
+//what the chain carries at runtime: the output buffer and the values (the rest is in the type)
+template<bool first, typename Skeleton, typename... Vs> struct document{
+  json_buffer_t& buf;
+  std::tuple<Vs...> values;
+
+  //begin_object / begin_array
+  template<fixed_string L> auto open() const { return document< true, typename Skeleton::template append< separated<first, L>() >, Vs... >{ buf, values }; }
+  //end_object / end_array
+  template<fixed_string L> auto close() const { return document< false, typename Skeleton::template append<L>, Vs... >{ buf, values }; }
+  //an entry with a literal value
+  template<fixed_string L> auto item() const { return document< false, typename Skeleton::template append< separated<first, L>() >, Vs... >{ buf, values }; }
+
+  //an entry with a runtime value: L, then a hole
+  template<fixed_string L, typename V> auto item( V const& v ) const {
+    static_assert( is_json_value<V>, "add_entry: the value must be a string, a number, a bool or nullptr" );
+    using W = json_value_t<V>;
+    using next = typename Skeleton::template append< separated<first, L>() >::hole;
+    return document< false, next, Vs..., W >{ buf, std::tuple_cat( values, std::tuple<W>( v ) ) };
+  }
+
+  std::string_view write() const { return Skeleton::template append< fixed_string( "}" ) >::write( buf, values ); }
+};
+
+//-- Internal DSL (the same closures and history as fluent_syntax_impl, the keys are template arguments)
+
+template<typename D, unsigned int closure, unsigned int depth, typename hist> struct skeleton_syntax_impl;
+
+template<unsigned int closure, unsigned int depth, typename hist, typename D> auto next_syntax( D const& d ){
+  return skeleton_syntax_impl< D, closure, depth, hist >{ d };
+}
+
+//At depth > 0 and inside an object you can use begin obj/arr and end obj
+template<typename D, unsigned int depth, typename hist> struct skeleton_syntax_impl<D, xobj, depth, hist>{
+  template<fixed_string K> auto begin_object() const { return next_syntax< xobj, depth+1, push_t<xobj, hist> >( d_.template open< quoted<K>() + fixed_string( ":{" ) >() ); }
+  template<fixed_string K> auto begin_array() const { return next_syntax< xarr, depth+1, push_t<xobj, hist> >( d_.template open< quoted<K>() + fixed_string( ":[" ) >() ); }
+
+  template<fixed_string K, typename V> auto add_entry( V const& v ) const { return next_syntax< xobj, depth, hist >( d_.template item< quoted<K>() + fixed_string( ":" ) >( v ) ); }
+  template<fixed_string K, fixed_string V> auto add_entry() const { return next_syntax< xobj, depth, hist >( d_.template item< quoted<K>() + fixed_string( ":" ) + quoted<V>() >() ); }
+
+  auto end_object() const { return next_syntax< history_pop<hist>::closure, depth-1, pop_t<hist> >( d_.template close< fixed_string( "}" ) >() ); }
+
+  D d_;
+};
+
+//At depth > 0 and inside an array you can use begin obj/arr and end arr
+template<typename D, unsigned int depth, typename hist> struct skeleton_syntax_impl<D, xarr, depth, hist>{
+  auto begin_object() const { return next_syntax< xobj, depth+1, push_t<xarr, hist> >( d_.template open< fixed_string( "{" ) >() ); }
+  auto begin_array() const { return next_syntax< xarr, depth+1, push_t<xarr, hist> >( d_.template open< fixed_string( "[" ) >() ); }
+
+  template<typename V> auto add_entry( V const& v ) const { return next_syntax< xarr, depth, hist >( d_.template item< fixed_string( "" ) >( v ) ); }
+  template<fixed_string V> auto add_entry() const { return next_syntax< xarr, depth, hist >( d_.template item< quoted<V>() >() ); }
+
+  auto end_array() const { return next_syntax< history_pop<hist>::closure, depth-1, pop_t<hist> >( d_.template close< fixed_string( "]" ) >() ); }
+
+  D d_;
+};
+
+//After begin / or at depth == 0 you can use begin obj/arr or end
+template<typename D> struct skeleton_syntax_impl<D, xroot, 0, history<>>{
+  template<fixed_string K> auto begin_object() const { return next_syntax< xobj, 1, history<> >( d_.template open< quoted<K>() + fixed_string( ":{" ) >() ); }
+  template<fixed_string K> auto begin_array() const { return next_syntax< xarr, 1, history<> >( d_.template open< quoted<K>() + fixed_string( ":[" ) >() ); }
+
+  std::string_view end() const { return d_.write(); }
+
+  D d_;
+};
+
+//This is the starting point
+struct skeleton_syntax{
+  explicit skeleton_syntax( json_buffer_t& buf ) : buf_{ buf } {}
+
+  auto begin() const { return next_syntax< xroot, 0, history<> >( document< true, skeleton< fixed_string( "{" ) > >{ buf_, {} } ); }
+
+private:
+  json_buffer_t& buf_;
+};
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+//the earthling through fluent_syntax, for any of its backends (state, json_writer_t); the names are runtime values
+template<typename S, typename... A> auto earthling( std::string_view first_name, std::string_view sure_name, A&&... a ){
+  return
+  fluent_syntax<S>( std::forward<A>(a)... )
+    .begin()
+      .begin_object( "earthling" )
+        .add_entry( "first_name", first_name )
+        .add_entry( "sure_name", sure_name )
+        .begin_array( "says" )
+          .add_entry( "hello" )
+          .add_entry( "world..." )
+          .begin_array()
+            .add_entry( "pam..." )
+            .add_entry( "pam..." )
+          .end_array()
+        .end_array()
+        .begin_object( "description" )
+          .add_entry( "mind", "funny" )
+          .add_entry( "body", "unknown" )
+        .end_object()
+      .end_object()
+    .end();
+}
+
+std::string earthling_stringstream( std::string_view first_name, std::string_view sure_name ){
+  return earthling<state>( first_name, sure_name );
+}
+
+std::string_view earthling_writer( json_buffer_t& buf, std::string_view first_name, std::string_view sure_name ){
+  buf.clear();
+  return earthling< json_writer_t<buffer_sink_t> >( first_name, sure_name, buffer_sink_t{ buf } );
+}
+
+//the names are runtime values (like in the other two), the rest is literal
+std::string_view earthling_skeleton( json_buffer_t& buf, std::string_view first_name, std::string_view sure_name ){
+  buf.clear();
+  return
+  skeleton_syntax( buf )
+    .begin()
+      .begin_object<"earthling">()
+        .add_entry<"first_name">( first_name )
+        .add_entry<"sure_name">( sure_name )
+        .begin_array<"says">()
+          .add_entry<"hello">()
+          .add_entry<"world...">()
+          .begin_array()
+            .add_entry<"pam...">()
+            .add_entry<"pam...">()
+          .end_array()
+        .end_array()
+        .begin_object<"description">()
+          .add_entry<"mind", "funny">()
+          .add_entry<"body", "unknown">()
+        .end_object()
+      .end_object()
+    .end();
+}
+
+//the telemetry payload from more_compile_time_magic.cpp
+std::string_view telemetry_writer( json_buffer_t& buf, long ts, double cpu, long rss, int requests ){
+  buf.clear();
+  return
+  fluent_syntax< json_writer_t<buffer_sink_t> >( buffer_sink_t{ buf } )
+    .begin()
+      .begin_object( "metrics" )
+        .add_entry( "host", "web-042.eu-west" )
+        .add_entry( "service", "checkout" )
+        .add_entry( "ts", ts )
+        .add_entry( "cpu", cpu )
+        .add_entry( "rss", rss )
+        .add_entry( "requests", requests )
+        .begin_array( "tags" )
+          .add_entry( "prod" )
+          .add_entry( "canary" )
+        .end_array()
+      .end_object()
+    .end();
+}
+
+std::string_view telemetry_skeleton( json_buffer_t& buf, long ts, double cpu, long rss, int requests ){
+  buf.clear();
+  return
+  skeleton_syntax( buf )
+    .begin()
+      .begin_object<"metrics">()
+        .add_entry<"host", "web-042.eu-west">()
+        .add_entry<"service", "checkout">()
+        .add_entry<"ts">( ts )
+        .add_entry<"cpu">( cpu )
+        .add_entry<"rss">( rss )
+        .add_entry<"requests">( requests )
+        .begin_array<"tags">()
+          .add_entry<"prod">()
+          .add_entry<"canary">()
+        .end_array()
+      .end_object()
+    .end();
+}
+
+#define SAMPLES 1000000
+
+template<typename B> double bench( const char* name, std::size_t bytes, B body ){
+  auto start = std::chrono::high_resolution_clock::now();
+  for( int i=0; i<SAMPLES; ++i ) body( i );
+  auto stop = std::chrono::high_resolution_clock::now();
+  double ns = std::chrono::duration_cast<std::chrono::nanoseconds>( stop - start ).count() / double( SAMPLES );
+  std::cout << name << " ns per payload: " << ns << " MB/s: " << bytes * 1000.0 / ns << "\n";
+  return ns;
+}
+
+void test_earthling(){
+  json_buffer_t buf1, buf2;
+  auto expected = std::string( earthling_writer( buf1, "stefan", "popa" ) );
+  auto json = std::string( earthling_skeleton( buf2, "stefan", "popa" ) );
+  std::cout << json << "\n";
+  std::cout << "test..." << ( json != expected ? "failed" : "passed" ) << "\n";
+
+  std::string src = json, dst = json;
+  auto floor = bench( "memcpy", json.size(), [&src, &dst]( int i ){ src[0] = char(i); std::memcpy( &dst[0], src.data(), src.size() ); asm volatile( "" : : "r"( dst.data() ) : "memory" ); } );
+  auto sk = bench( "skeleton_syntax", json.size(), [&buf2]( int ){ auto r = earthling_skeleton( buf2, "stefan", "popa" ); asm volatile( "" : : "r"( r.data() ) : "memory" ); } );
+  auto w = bench( "json_writer_t", json.size(), [&buf1]( int ){ auto r = earthling_writer( buf1, "stefan", "popa" ); asm volatile( "" : : "r"( r.data() ) : "memory" ); } );
+  auto ss = bench( "std::stringstream", json.size(), []( int ){ auto r = earthling_stringstream( "stefan", "popa" ); asm volatile( "" : : "r"( r.data() ) : "memory" ); } );
+  std::cout << "skeleton_syntax / memcpy: " << sk / floor << "x, json_writer_t / skeleton_syntax: " << w / sk << "x, std::stringstream / skeleton_syntax: " << ss / sk << "x\n";
+}
+
+void test_telemetry(){
+  json_buffer_t buf1, buf2;
+  auto expected = std::string( telemetry_writer( buf1, 1760790000123L, 0.734, 734003200L, 129331 ) );
+  auto json = std::string( telemetry_skeleton( buf2, 1760790000123L, 0.734, 734003200L, 129331 ) );
+  std::cout << json << "\n";
+  std::cout << "test..." << ( json != expected ? "failed" : "passed" ) << "\n";
+
+  auto sk = bench( "skeleton_syntax", json.size(), [&buf2]( int i ){ auto r = telemetry_skeleton( buf2, 1760790000123L + i, 0.734, 734003200L, 129331 + i ); asm volatile( "" : : "r"( r.data() ) : "memory" ); } );
+  auto w = bench( "json_writer_t", json.size(), [&buf1]( int i ){ auto r = telemetry_writer( buf1, 1760790000123L + i, 0.734, 734003200L, 129331 + i ); asm volatile( "" : : "r"( r.data() ) : "memory" ); } );
+  std::cout << "json_writer_t / skeleton_syntax: " << w / sk << "x\n";
+}
+
+void test_escaping(){
+  json_buffer_t buf1, buf2;
+  std::string_view v = "a \"quoted\"\tvalue\\ \x01";
+  json_writer_t<buffer_sink_t> s{ buffer_sink_t{ buf1 } };
+  s.begin();
+  s.begin_object( "k\"1" );
+  s.add_entry( "lit\n", "x\"y" );
+  s.add_entry( "run", v );
+  s.add_entry( "yes", true );
+  s.add_entry( "nothing", nullptr );
+  s.end_object();
+  auto expected = std::string( s.end() );
+
+  auto json = skeleton_syntax( buf2 ).begin().begin_object<"k\"1">().add_entry<"lit\n", "x\"y">().add_entry<"run">( v ).add_entry<"yes">( true ).add_entry<"nothing">( nullptr ).end_object().end();
+  std::cout << "test_escaping..." << ( json != expected ? "failed" : "passed" ) << "\n";
+}
+
+/*
+Example (on a 1 vcpu vm, -O2):
+
+test_escaping...passed
+{"earthling":{"first_name":"stefan","sure_name":"popa","says":["hello","world...",["pam...","pam..."]],"description":{"mind":"funny","body":"unknown"}}}
+test...passed
+memcpy ns per payload: 12.0464 MB/s: 12617.8
+skeleton_syntax ns per payload: 61.8399 MB/s: 2457.96
+json_writer_t ns per payload: 305.915 MB/s: 496.87
+std::stringstream ns per payload: 1271.71 MB/s: 119.524
+skeleton_syntax / memcpy: 5.13346x, json_writer_t / skeleton_syntax: 4.94689x, std::stringstream / skeleton_syntax: 20.5646x
+{"metrics":{"host":"web-042.eu-west","service":"checkout","ts":1760790000123,"cpu":0.734,"rss":734003200,"requests":129331,"tags":["prod","canary"]}}
+test...passed
+skeleton_syntax ns per payload: 109.768 MB/s: 1357.41
+json_writer_t ns per payload: 410.572 MB/s: 362.908
+json_writer_t / skeleton_syntax: 3.74036x
+
+All three backends go through the same earthling document (the names as runtime values): state and json_writer_t through
+the same fluent_syntax chain (fluent_syntax.hpp), skeleton_syntax through its own with the same closures. From run to run
+(1 vcpu vm) the skeleton is 4.5 - 7x memcpy, json_writer_t 4 - 5.5x the skeleton and the stringstream 20 - 28x,
+and on the telemetry payload json_writer_t is 3 - 3.7x the skeleton.
+
+With only strings to splice it is a few memcpys; with numbers what is left is to_chars (~25 ns per long, ~90 per double).
+*/
+
+int main(){
+  test_escaping();
+  test_earthling();
+  test_telemetry();
+
+  //it does not compile... (end_array inside an object)
+  /*
+  json_buffer_t buf;
+  skeleton_syntax( buf ).begin().begin_object<"earthling">().end_array();
+  */
+  return 0;
+}
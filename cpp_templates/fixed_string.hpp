@@ -0,0 +1,36 @@
+#ifndef FIXED_STRING_HPP
+#define FIXED_STRING_HPP
+
+#include <cstddef>
+#include <string_view>
+
+/*
+fixed_string<N>: a string literal as a C++20 class type non type template parameter
+
+  template<fixed_string Key> ...   used as   thing<"key">
+
+Used for the keys / literal segments of the JSON skeletons (even_more_compile_time_magic.cpp)
+and for the keys of the parser schemas (schema_driven_json_parser.cpp).
+operator+ concatenates at compile time (the result is again a fixed_string, so it can be a template argument too).
+*/
+
+template<std::size_t N> struct fixed_string{
+  char data[N+1] {};
+
+  constexpr fixed_string() = default;
+  constexpr fixed_string( const char (&s)[N+1] ){ for( std::size_t i=0; i<N; ++i ) data[i] = s[i]; }
+
+  constexpr std::size_t size() const { return N; }
+  constexpr std::string_view view() const { return std::string_view( data, N ); }
+};
+
+template<std::size_t N> fixed_string( const char (&)[N] ) -> fixed_string<N-1>;
+
+template<std::size_t N, std::size_t M> constexpr fixed_string<N+M> operator+( fixed_string<N> const& a, fixed_string<M> const& b ){
+  fixed_string<N+M> r;
+  for( std::size_t i=0; i<N; ++i ) r.data[i] = a.data[i];
+  for( std::size_t i=0; i<M; ++i ) r.data[N+i] = b.data[i];
+  return r;
+}
+
+#endif
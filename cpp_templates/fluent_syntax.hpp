@@ -0,0 +1,150 @@
+#ifndef FLUENT_SYNTAX_HPP
+#define FLUENT_SYNTAX_HPP
+
+#include <string>
+#include <sstream>
+#include <string_view>
+#include <charconv>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+
+#include "json_writer.hpp"
+
+/*
+The fluent_syntax DSL (see more_compile_time_magic.cpp): only valid call sequences compile. The backend S does the output:
+- state: the original one, a JSON like text through a std::stringstream
+- json_writer_t (json_writer.hpp): real JSON, into a buffer or straight to a file descriptor
+Shared by more_compile_time_magic.cpp and even_more_compile_time_magic.cpp (which compares both backends with skeleton_syntax).
+*/
+
+using key = std::string_view;
+using val = std::string_view;
+
+#define T first = true; 
+#define F first = false; 
+#define IST (first ? " " : ", ")
+
+struct state{
+  void begin() { ss << "{ "; T }
+  std::string end() { ss << " }\n"; return ss.str(); }
+
+  void begin_object( key const& k ){ ss << IST << k << ": { "; T }
+  void begin_object(){ ss << IST << " { "; T }
+  void end_object(){ ss << " } "; F }
+  
+  void begin_array( key const& k ){ ss << IST << k << ": [ "; T }
+  void begin_array(){ ss << IST << " [ "; T }
+  void end_array(){ ss << " ] "; F }
+
+  template<typename V> void add_entry( key const& k, V const& v ){ ss << IST << k << ": "; put( v ); ss << " "; F }
+  template<typename V> void add_entry( V const& v ){ ss << IST; put( v ); ss << " "; F }
+
+private:
+  void put( val const& v ){ ss << v; }
+  void put( const char* v ){ ss << v; }
+  void put( bool v ){ ss << ( v ? "true" : "false" ); }
+  void put( std::nullptr_t ){ ss << "null"; }
+
+  //numbers: to_chars into the stack and one write, no std::to_string temporary (NaN / +-Inf go as null, like json_writer_t)
+  template<typename N, typename = typename std::enable_if< is_json_number<N> >::type>
+  void put( N v ){
+    char buf[ JSON_NUMBER_SIZE ];
+    ss.write( buf, json_number( buf, buf + sizeof(buf), v ) - buf );
+  }
+
+  bool              first;
+  std::stringstream ss;
+};
+
+#undef T
+#undef F
+#undef IST
+
+//-- Internal DSL:
+//Supported operations are:
+//  begin
+//  end
+//  begin_object
+//  end_object
+//  begin_array
+//  end_array
+//  add_entry
+
+#define xobj 0
+#define xarr 1
+#define xroot 2
+
+//Values can be strings, numbers, bool or nullptr (null); anything else is rejected here, before it reaches the backend
+template<typename V> constexpr void check_value(){ static_assert( is_json_value<V>, "add_entry: the value must be a string, a number, a bool or nullptr" ); }
+
+//The closures of the enclosing levels, innermost first: begin obj/arr pushes the current closure, end obj/arr pops it.
+//(it used to be the bits of an unsigned int, which silently wrapped after 32 levels)
+template<unsigned int... closures> struct history{};
+
+template<unsigned int closure, typename hist> struct history_push;
+template<unsigned int closure, unsigned int... closures> struct history_push< closure, history<closures...> >{ using type = history<closure, closures...>; };
+
+template<typename hist> struct history_pop{ static constexpr unsigned int closure = xroot; using type = history<>; };  //back at the root
+template<unsigned int c, unsigned int... closures> struct history_pop< history<c, closures...> >{ static constexpr unsigned int closure = c; using type = history<closures...>; };
+
+template<unsigned int closure, typename hist> using push_t = typename history_push<closure, hist>::type;
+template<typename hist> using pop_t = typename history_pop<hist>::type;
+
+//The backend (S) is the one doing the actual output: state (above) or json_writer_t (json_writer.hpp)
+template<typename S, unsigned int closure, unsigned int depth, typename hist> struct fluent_syntax_impl;
+
+//At depth > 0 and inside an object you can use begin obj/arr and end obj
+template<typename S, unsigned int depth, typename hist> struct fluent_syntax_impl<S, xobj, depth, hist>{  //specialize the template for this closure
+  fluent_syntax_impl( S& s ) : s_{s} {}
+  
+  auto begin_object( key const& k ){ s_.begin_object(k); return fluent_syntax_impl< S, xobj, depth+1, push_t<xobj, hist>>{s_};  }
+  auto begin_array( key const& k ){ s_.begin_array(k); return fluent_syntax_impl< S, xarr, depth+1, push_t<xobj, hist>>{s_};  }
+  
+  template<typename V> auto add_entry( key const& k, V const& v ){ check_value<V>(); s_.add_entry(k,v); return fluent_syntax_impl< S, xobj, depth, hist>{s_};  }
+
+  auto end_object(){ s_.end_object(); return fluent_syntax_impl< S, history_pop<hist>::closure, depth-1, pop_t<hist> >{s_};  }
+
+private:
+  S& s_;
+};
+
+//At depth > 0 and inside an array you can use begin obj/arr and end arr
+template<typename S, unsigned int depth, typename hist> struct fluent_syntax_impl<S, xarr, depth, hist>{  //specialize the template for this closure
+  fluent_syntax_impl( S& s ) : s_{s} {}
+  
+  auto begin_object(){ s_.begin_object(); return fluent_syntax_impl< S, xobj, depth+1, push_t<xarr, hist> >{s_};  }
+  auto begin_array(){ s_.begin_array(); return fluent_syntax_impl< S, xarr, depth+1, push_t<xarr, hist> >{s_};  }
+
+  template<typename V> auto add_entry( V const& v ){ check_value<V>(); s_.add_entry(v); return fluent_syntax_impl< S, xarr, depth, hist>{s_};  }
+
+  auto end_array(){ s_.end_array(); return fluent_syntax_impl< S, history_pop<hist>::closure, depth-1, pop_t<hist> >{s_};  }
+
+private:
+  S& s_;
+};
+
+//After begin / or at depth == 0 you can use begin obj/arr or end
+template<typename S> struct fluent_syntax_impl<S, xroot, 0, history<>>{  //specialize the template for this depth
+  fluent_syntax_impl( S& s ) : s_{s} {}
+  
+  auto begin_object( key const& k ){ s_.begin_object(k); return fluent_syntax_impl< S, xobj, 1, history<> >{s_};  }
+  auto begin_array( key const& k ){ s_.begin_array(k); return fluent_syntax_impl< S, xarr, 1, history<> >{s_};  }
+
+  auto end(){ return s_.end(); }
+
+private:
+  S& s_;
+};
+
+//This is the starting point
+template<typename S = state> struct fluent_syntax{ 
+  fluent_syntax() = default;
+  template<typename... A> explicit fluent_syntax( A&&... a ) : s_( std::forward<A>(a)... ) {}
+
+  auto begin() { s_.begin(); return fluent_syntax_impl<S, xroot, 0, history<>>{s_}; }
+private:
+  S s_;
+};
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef JSON_WRITER_HPP
+#define JSON_WRITER_HPP
+
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <cstring>
+#include <cmath>
+#include <cerrno>
+#include <cstddef>
+#include <type_traits>
+#include <memory>
+#include <algorithm>
+#include <unistd.h>
+
+/*
+Streaming JSON writer (a backend for fluent_syntax, see more_compile_time_magic.cpp)
+
+The original state appends everything to a std::stringstream, which means:
+- locale aware formatting for every number
+- the stream buffer grows (reallocates) while the document is built and str() copies it once more at the end
+- every key / value is a std::string (a copy of each literal)
+
+json_writer_t<Sink> instead:
+- takes std::string_view for keys and strings and formats numbers with std::to_chars (no locale, no allocation);
+  bool and nullptr are written as true / false / null, and so are NaN / +-Inf (JSON has no spelling for them)
+- writes straight into a sink:
+    buffer_sink_t: appends to a caller provided json_buffer_t; reuse it (clear() keeps the memory) and there is no allocation at all
+    fd_sink_t:     a fixed (stack / member) buffer flushed with write(fd) when full and at the end
+- escapes strings properly (", \, control characters), copying the runs that need no escaping in one go
+- emits real JSON: {"key":"value","n":1}
+
+The separators are decided with the same "first" flag as state (that part stays a runtime decision here).
+*/
+
+//a growable buffer owned by the caller: clear() keeps the memory, so once it is warm nothing is allocated anymore
+struct json_buffer_t{
+  std::string_view view() const { return std::string_view( data_.get(), size_ ); }
+  void clear(){ size_ = 0; }
+
+  void reserve( std::size_t n ){
+    if( n <= capacity_ ) return;
+    auto bigger = std::max( n, 2*capacity_ );
+    std::unique_ptr<char[]> tmp( new char[ bigger ] );
+    if( size_ ) std::memcpy( tmp.get(), data_.get(), size_ );
+    data_ = std::move( tmp );
+    capacity_ = bigger;
+  }
+
+  std::unique_ptr<char[]> data_;
+  std::size_t size_ = 0, capacity_ = 0;
+};
+
+//works on its own copy of the end pointers (the buffer only gets its size back in finish), so the hot path is a compare + a store
+struct buffer_sink_t{
+  explicit buffer_sink_t( json_buffer_t& buf ) : buf_{ buf }, cur_{ buf.data_.get() + buf.size_ }, end_{ buf.data_.get() + buf.capacity_ } {}
+
+  void put( char c ){
+    if( cur_ == end_ ) grow( 1 );
+    *cur_++ = c;
+  }
+
+  void write( const char* p, std::size_t n ){
+    if( std::size_t( end_ - cur_ ) < n ) grow( n );
+    std::memcpy( cur_, p, n );
+    cur_ += n;
+  }
+
+  std::string_view finish(){
+    buf_.size_ = cur_ - buf_.data_.get();
+    return buf_.view();
+  }
+
+  //the offset of the next byte in the buffer
+  std::size_t position() const { return cur_ - buf_.data_.get(); }
+
+private:
+  void grow( std::size_t n ){
+    buf_.size_ = cur_ - buf_.data_.get();
+    buf_.reserve( buf_.size_ + n );
+    cur_ = buf_.data_.get() + buf_.size_;
+    end_ = buf_.data_.get() + buf_.capacity_;
+  }
+
+  json_buffer_t& buf_;
+  char *cur_, *end_;
+};
+
+#define FD_SINK_BUFFER 4096
+
+struct fd_sink_t{
+  explicit fd_sink_t( int fd ) : fd_{ fd } {}
+
+  void put( char c ){
+    if( size_ == FD_SINK_BUFFER ) flush();
+    buf_[ size_++ ] = c;
+  }
+
+  void write( const char* p, std::size_t n ){
+    if( size_ + n > FD_SINK_BUFFER ) flush();
+    if( n > FD_SINK_BUFFER ){ write_all( p, n ); return; }  //too big to buffer
+    std::memcpy( buf_ + size_, p, n );
+    size_ += n;
+  }
+
+  //flushes and returns the number of bytes written so far
+  std::size_t finish(){
+    flush();
+    return written_;
+  }
+
+  void flush(){
+    write_all( buf_, size_ );
+    size_ = 0;
+  }
+
+private:
+  void write_all( const char* p, std::size_t n ){
+    while( n > 0 ){
+      auto r = ::write( fd_, p, n );
+      if( r < 0 ){ if( errno == EINTR ) continue; return; }  //nothing sensible to do with the error here...
+      p += r; n -= r; written_ += r;
+    }
+  }
+
+  int fd_;
+  char buf_[ FD_SINK_BUFFER ];
+  std::size_t size_ = 0, written_ = 0;
+};
+
+//characters that can't go as they are inside a JSON string
+struct escape_table_t{
+  bool v[256];
+  constexpr escape_table_t() : v{} { for( int c=0; c<256; ++c ) v[c] = c < 0x20 || c == '"' || c == '\\'; }
+  constexpr bool operator[]( unsigned char c ) const { return v[c]; }
+};
+
+inline constexpr escape_table_t needs_escape{};
+
+//the value types the writers (and the fluent_syntax add_entry) accept: strings, numbers, bool and null
+//(char, wchar_t, char16_t, char32_t are characters, not numbers: they don't compile - signed / unsigned char (int8_t / uint8_t) are numbers)
+template<typename V> constexpr bool is_json_char =
+  std::is_same<V, char>::value || std::is_same<V, wchar_t>::value || std::is_same<V, char16_t>::value || std::is_same<V, char32_t>::value
+#ifdef __cpp_char8_t
+  || std::is_same<V, char8_t>::value
+#endif
+  ;
+
+template<typename V> constexpr bool is_json_number = std::is_arithmetic<V>::value && !std::is_same<V, bool>::value && !is_json_char<V>;
+
+template<typename V> constexpr bool is_json_value =
+  is_json_number<V> || std::is_same<V, bool>::value || std::is_same<V, std::nullptr_t>::value || std::is_convertible<V const&, std::string_view>::value;
+
+//a number as JSON text at p (end - p >= JSON_NUMBER_SIZE): to_chars, or null for NaN / +-Inf
+#define JSON_NUMBER_SIZE 32
+
+template<typename N> char* json_number( char* p, char* end, N v ){
+  if constexpr( std::is_floating_point<N>::value ){
+    if( !std::isfinite( v ) ){ std::memcpy( p, "null", 4 ); return p + 4; }
+  }
+  return std::to_chars( p, end, v ).ptr;
+}
+
+template<typename Sink> class json_writer_t{
+public:
+  explicit json_writer_t( Sink sink ) : out_{ sink } {}
+
+  void begin(){ out_.put( '{' ); first_ = true; }
+  auto end(){ out_.put( '}' ); return out_.finish(); }
+
+  void begin_object( std::string_view k ){ write_key( k ); out_.put( '{' ); first_ = true; }
+  void begin_object(){ separator(); out_.put( '{' ); first_ = true; }
+  void end_object(){ out_.put( '}' ); first_ = false; }
+
+  void begin_array( std::string_view k ){ write_key( k ); out_.put( '[' ); first_ = true; }
+  void begin_array(){ separator(); out_.put( '[' ); first_ = true; }
+  void end_array(){ out_.put( ']' ); first_ = false; }
+
+  template<typename V> void add_entry( std::string_view k, V const& v ){ write_key( k ); write_value( v ); }
+  template<typename V> void add_entry( V const& v ){ separator(); write_value( v ); }
+
+  //a fragment: array elements (or object members) with the separators between them, but without the brackets around them
+  //(built somewhere else, e.g. on another thread, and spliced into the document later)
+  void begin_fragment(){ first_ = true; }
+  auto end_fragment(){ return out_.finish(); }
+
+  //the place for a (non empty) fragment built somewhere else: writes the separator and returns the offset to splice it at
+  std::size_t splice(){ separator(); return out_.position(); }
+
+private:
+  void separator(){
+    if( !first_ ) out_.put( ',' );
+    first_ = false;
+  }
+
+  void write_key( std::string_view k ){
+    separator();
+    write_string( k );
+    out_.put( ':' );
+  }
+
+  void write_value( std::string_view v ){ write_string( v ); }
+  void write_value( const char* v ){ write_string( v ); }
+
+  void write_value( bool v ){ v ? out_.write( "true", 4 ) : out_.write( "false", 5 ); }
+  void write_value( std::nullptr_t ){ out_.write( "null", 4 ); }
+
+  template<typename N, typename = typename std::enable_if< is_json_number<N> >::type>
+  void write_value( N v ){
+    char buf[ JSON_NUMBER_SIZE ];
+    out_.write( buf, json_number( buf, buf + sizeof(buf), v ) - buf );
+  }
+
+  void write_string( std::string_view s ){
+    static const char hex[] = "0123456789abcdef";
+    out_.put( '"' );
+    std::size_t run = 0;
+    for( std::size_t i=0; i<s.size(); ++i ){
+      auto c = static_cast<unsigned char>( s[i] );
+      if( !needs_escape[c] ) continue;
+      out_.write( s.data() + run, i - run );  //the run that needs no escaping
+      run = i + 1;
+      switch( c ){
+        case '"':  out_.write( "\\\"", 2 ); break;
+        case '\\': out_.write( "\\\\", 2 ); break;
+        case '\n': out_.write( "\\n", 2 ); break;
+        case '\r': out_.write( "\\r", 2 ); break;
+        case '\t': out_.write( "\\t", 2 ); break;
+        default:{
+          char u[] = { '\\', 'u', '0', '0', hex[ c >> 4 ], hex[ c & 15 ] };
+          out_.write( u, sizeof(u) );
+        }
+      }
+    }
+    out_.write( s.data() + run, s.size() - run );
+    out_.put( '"' );
+  }
+
+  Sink out_;
+  bool first_ = true;
+};
+
+#endif
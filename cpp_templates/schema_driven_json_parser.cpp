@@ -0,0 +1,679 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <variant>
+#include <random>
+#include <chrono>
+#include <charconv>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#if defined(__SSE2__) && !defined(JSON_NO_SIMD)
+#include <emmintrin.h>
+#define JSON_SIMD 1
+#endif
+
+#include "json_writer.hpp"
+#include "fixed_string.hpp"
+
+//Compile: g++ schema_driven_json_parser.cpp -std=c++20 -O2 (add -DJSON_NO_SIMD for the scalar scanning)
+
+/*
+Schema driven JSON parser
+
+fluent_syntax (more_compile_time_magic.cpp) and json_writer_t (json_writer.hpp) only go one way: struct -> text.
+This is the way back, for documents with a known shape: the schema of a struct is declared once, in the same template style,
+
+  struct description_t{ std::string_view mind, body; };
+  template<> struct json_schema<description_t>{ using type = object< field<"mind", &description_t::mind>, field<"body", &description_t::body> >; };
+
+and the parser goes straight from the text into the struct (SAX style: no DOM, no std::string per key / value):
+- keys are matched against the fixed_string keys of the schema, unknown keys are skipped, a missing key is an error
+  and so is a key of the schema that appears twice (no silent "last one wins")
+- strings are std::string_view into the input: the input is a (mutable) std::string and the rare escaped strings are
+  unescaped in place, so nothing is copied (the views live as long as the input)
+- numbers are checked against the JSON number grammar (no leading zeros, '+', '.5', hex...) and then go through std::from_chars,
+  bool as true / false
+- std::vector<V> for arrays, std::variant<As...> for the values that can have more than one type
+  (the alternative is picked by the first character: '"' string, '[' array, '{' object, 't'/'f' bool, anything else a number)
+- the scanning for the end of a string and for the structure of a skipped value is done 16 bytes at a time (SSE2)
+
+The schema is checked at compile time: every field must be a member of the struct, have a supported type and a unique key.
+Errors in the input throw json_parse_error (with the offset).
+
+The same schema drives json_emit (through json_writer_t), so a document can be round tripped.
+*/
+
+//-- the schema
+
+template<typename T> struct json_schema;  //specialize it for every struct: using type = object< field<...>, ... >
+
+template<typename C, typename M> C member_class( M C::* );
+template<typename C, typename M> M member_type( M C::* );
+
+template<fixed_string Key, auto Member> struct field{
+  static constexpr std::string_view key = Key.view();
+  static constexpr auto member = Member;
+  using class_type = decltype( member_class( Member ) );
+  using value_type = decltype( member_type( Member ) );
+};
+
+template<typename V> struct is_vector : std::false_type {};
+template<typename V> struct is_vector< std::vector<V> > : std::true_type {};
+
+template<typename V> struct is_variant : std::false_type {};
+template<typename... As> struct is_variant< std::variant<As...> > : std::true_type {};
+
+template<typename V> concept has_json_schema = requires { typename json_schema<V>::type; };
+
+template<typename V> struct is_json_parsable : std::bool_constant< std::is_same<V, std::string_view>::value || std::is_same<V, bool>::value || is_json_number<V> || has_json_schema<V> > {};
+template<typename V> struct is_json_parsable< std::vector<V> > : is_json_parsable<V> {};
+template<typename... As> struct is_json_parsable< std::variant<As...> > : std::bool_constant< ( is_json_parsable<As>::value && ... ) > {};
+
+template<typename... Fields> constexpr bool unique_keys(){
+  std::string_view keys[] = { Fields::key... };
+  for( std::size_t i=0; i<sizeof...(Fields); ++i )
+    for( std::size_t j=i+1; j<sizeof...(Fields); ++j )
+      if( keys[i] == keys[j] ) return false;
+  return true;
+}
+
+template<typename... Fields> struct object{
+  static_assert( sizeof...(Fields) > 0 && sizeof...(Fields) <= 64, "object: 1 to 64 fields" );
+  static_assert( unique_keys<Fields...>(), "object: duplicate key" );
+  static_assert( ( is_json_parsable< typename Fields::value_type >::value && ... ), "object: unsupported field type (string_view, bool, number, vector, variant or a struct with a json_schema)" );
+
+  static constexpr std::uint64_t all = sizeof...(Fields) == 64 ? ~std::uint64_t(0) : ( std::uint64_t(1) << sizeof...(Fields) ) - 1;
+
+  //f( key, member ) for every field
+  template<typename T, typename F> static void each( T& out, F&& f ){
+    check<T>();
+    ( f( Fields::key, out.*Fields::member ), ... );
+  }
+
+  //f( member, seen_before ) for the field with this key (and marks it as seen); false if there is no such key
+  template<typename T, typename F> static bool find( std::string_view key, T& out, std::uint64_t& seen, F&& f ){
+    check<T>();
+    return find_impl( key, out, seen, f, std::index_sequence_for<Fields...>{} );
+  }
+
+private:
+  template<typename T> static constexpr void check(){
+    static_assert( ( std::is_same< typename Fields::class_type, std::remove_const_t<T> >::value && ... ), "object: the field is not a member of this struct" );
+  }
+
+  template<typename T, typename F, std::size_t... I> static bool find_impl( std::string_view key, T& out, std::uint64_t& seen, F& f, std::index_sequence<I...> ){
+    return ( ( key == Fields::key ? ( f( out.*Fields::member, ( seen & std::uint64_t(1) << I ) != 0 ), seen |= std::uint64_t(1) << I, true ) : false ) || ... );
+  }
+};
+
+//-- scanning
+
+//the first '"' or '\' in [p, end), end if there is none
+inline char* find_quote( char* p, char* end ){
+#ifdef JSON_SIMD
+  const __m128i quote = _mm_set1_epi8( '"' ), backslash = _mm_set1_epi8( '\\' );
+  while( end - p >= 16 ){
+    __m128i c = _mm_loadu_si128( reinterpret_cast<const __m128i*>( p ) );
+    int m = _mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi8( c, quote ), _mm_cmpeq_epi8( c, backslash ) ) );
+    if( m ) return p + __builtin_ctz( m );
+    p += 16;
+  }
+#endif
+  while( p != end && *p != '"' && *p != '\\' ) ++p;
+  return p;
+}
+
+//the first structural character of a skipped value ('"', '{', '}', '[', ']') in [p, end), end if there is none
+inline char* find_structural( char* p, char* end ){
+#ifdef JSON_SIMD
+  const __m128i quote = _mm_set1_epi8( '"' ), lcurly = _mm_set1_epi8( '{' ), rcurly = _mm_set1_epi8( '}' ), lsquare = _mm_set1_epi8( '[' ), rsquare = _mm_set1_epi8( ']' );
+  while( end - p >= 16 ){
+    __m128i c = _mm_loadu_si128( reinterpret_cast<const __m128i*>( p ) );
+    __m128i curly = _mm_or_si128( _mm_cmpeq_epi8( c, lcurly ), _mm_cmpeq_epi8( c, rcurly ) );
+    __m128i square = _mm_or_si128( _mm_cmpeq_epi8( c, lsquare ), _mm_cmpeq_epi8( c, rsquare ) );
+    int m = _mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi8( c, quote ), _mm_or_si128( curly, square ) ) );
+    if( m ) return p + __builtin_ctz( m );
+    p += 16;
+  }
+#endif
+  while( p != end && *p != '"' && *p != '{' && *p != '}' && *p != '[' && *p != ']' ) ++p;
+  return p;
+}
+
+//-- the parser
+
+struct json_parse_error : std::runtime_error{
+  json_parse_error( const char* what, std::size_t offset ) : std::runtime_error( std::string( what ) + " at offset " + std::to_string( offset ) ), offset{ offset } {}
+  std::size_t offset;
+};
+
+class json_parser_t{
+public:
+  explicit json_parser_t( std::string& text ) : begin_{ text.data() }, p_{ text.data() }, end_{ text.data() + text.size() } {}
+
+  //the whole text is one object described by json_schema<T>
+  template<typename T> void parse( T& out ){
+    static_assert( has_json_schema<T>, "parse: the document must be a struct with a json_schema" );
+    ws();
+    value( out );
+    ws();
+    if( p_ != end_ ) error( "trailing characters" );
+  }
+
+  template<typename V> void value( V& out ){
+    if constexpr( std::is_same<V, std::string_view>::value ){ expect( '"' ); out = string(); }
+    else if constexpr( std::is_same<V, bool>::value ) boolean( out );
+    else if constexpr( is_json_number<V> ) number( out );
+    else if constexpr( is_vector<V>::value ) array( out );
+    else if constexpr( is_variant<V>::value ) variant( out );
+    else object( out );
+  }
+
+private:
+  [[noreturn]] void error( const char* what ) const { throw json_parse_error( what, p_ - begin_ ); }
+
+  void ws(){ while( p_ != end_ && ( *p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t' ) ) ++p_; }
+  char peek() const { return p_ != end_ ? *p_ : '\0'; }
+  void expect( char c ){ if( peek() != c ) error( "unexpected character" ); ++p_; }
+
+  //after the opening quote; escapes are resolved in place, so the view is always one piece of the input
+  std::string_view string(){
+    char* start = p_;
+    char* q = find_quote( p_, end_ );
+    if( q != end_ && *q == '"' ){ p_ = q + 1; return std::string_view( start, q - start ); }  //no escape: the common case
+    char* out = q;
+    p_ = q;
+    for( ;; ){
+      if( p_ == end_ ) error( "unterminated string" );
+      if( *p_ == '"' ){ ++p_; return std::string_view( start, out - start ); }
+      if( *p_ != '\\' ){ *out++ = *p_++; continue; }
+      if( ++p_ == end_ ) error( "unterminated string" );
+      switch( *p_++ ){
+        case '"':  *out++ = '"'; break;
+        case '\\': *out++ = '\\'; break;
+        case '/':  *out++ = '/'; break;
+        case 'b':  *out++ = '\b'; break;
+        case 'f':  *out++ = '\f'; break;
+        case 'n':  *out++ = '\n'; break;
+        case 'r':  *out++ = '\r'; break;
+        case 't':  *out++ = '\t'; break;
+        case 'u':  out = unicode( out ); break;  //\uXXXX is 6 characters, the utf-8 is at most 4
+        default: error( "invalid escape" );
+      }
+      char* n = find_quote( p_, end_ );  //copy the run up to the next quote / escape
+      std::memmove( out, p_, n - p_ );
+      out += n - p_;
+      p_ = n;
+    }
+  }
+
+  unsigned hex4(){
+    if( end_ - p_ < 4 ) error( "invalid \\u escape" );
+    unsigned v = 0;
+    for( int i=0; i<4; ++i ){
+      char c = *p_++;
+      v <<= 4;
+      if( c >= '0' && c <= '9' ) v |= c - '0';
+      else if( c >= 'a' && c <= 'f' ) v |= c - 'a' + 10;
+      else if( c >= 'A' && c <= 'F' ) v |= c - 'A' + 10;
+      else error( "invalid \\u escape" );
+    }
+    return v;
+  }
+
+  char* unicode( char* out ){
+    unsigned cp = hex4();
+    if( cp >= 0xD800 && cp < 0xDC00 ){  //a surrogate pair
+      if( end_ - p_ < 6 || p_[0] != '\\' || p_[1] != 'u' ) error( "invalid surrogate pair" );
+      p_ += 2;
+      unsigned lo = hex4();
+      if( lo < 0xDC00 || lo >= 0xE000 ) error( "invalid surrogate pair" );
+      cp = 0x10000 + ( ( cp - 0xD800 ) << 10 ) + ( lo - 0xDC00 );
+    }else if( cp >= 0xDC00 && cp < 0xE000 ){  //a low surrogate without the high one before it
+      error( "invalid surrogate" );
+    }
+    if( cp < 0x80 ){ *out++ = char( cp ); }
+    else if( cp < 0x800 ){ *out++ = char( 0xC0 | cp >> 6 ); *out++ = char( 0x80 | ( cp & 0x3F ) ); }
+    else if( cp < 0x10000 ){ *out++ = char( 0xE0 | cp >> 12 ); *out++ = char( 0x80 | ( ( cp >> 6 ) & 0x3F ) ); *out++ = char( 0x80 | ( cp & 0x3F ) ); }
+    else{ *out++ = char( 0xF0 | cp >> 18 ); *out++ = char( 0x80 | ( ( cp >> 12 ) & 0x3F ) ); *out++ = char( 0x80 | ( ( cp >> 6 ) & 0x3F ) ); *out++ = char( 0x80 | ( cp & 0x3F ) ); }
+    return out;
+  }
+
+  void boolean( bool& out ){
+    if( end_ - p_ >= 4 && std::memcmp( p_, "true", 4 ) == 0 ){ out = true; p_ += 4; return; }
+    if( end_ - p_ >= 5 && std::memcmp( p_, "false", 5 ) == 0 ){ out = false; p_ += 5; return; }
+    error( "expected a bool" );
+  }
+
+  //-?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? - from_chars alone takes "007" and "1." (and "inf" / "nan" for the doubles)
+  char* number_end() const {
+    char* q = p_;
+    auto digits = [&q, this](){ char* d = q; while( q != end_ && *q >= '0' && *q <= '9' ) ++q; return q != d; };
+    if( q != end_ && *q == '-' ) ++q;
+    if( q != end_ && *q == '0' ) ++q;
+    else if( !digits() ) error( "invalid number" );
+    if( q != end_ && *q == '.' ){ ++q; if( !digits() ) error( "invalid number" ); }
+    if( q != end_ && ( *q == 'e' || *q == 'E' ) ){
+      ++q;
+      if( q != end_ && ( *q == '+' || *q == '-' ) ) ++q;
+      if( !digits() ) error( "invalid number" );
+    }
+    return q;
+  }
+
+  template<typename N> void number( N& out ){
+    char* e = number_end();
+    auto r = std::from_chars( p_, e, out );
+    if( r.ec != std::errc() || r.ptr != e ) error( "expected a number" );  //out of range, or a fraction for an integer
+    p_ = e;
+  }
+
+  template<typename V> void array( std::vector<V>& out ){
+    expect( '[' );
+    out.clear();
+    ws();
+    if( peek() == ']' ){ ++p_; return; }
+    for( ;; ){
+      ws();
+      out.emplace_back();
+      value( out.back() );
+      ws();
+      if( peek() == ',' ){ ++p_; continue; }
+      expect( ']' );
+      return;
+    }
+  }
+
+  template<typename V> static constexpr bool starts_with( char c ){
+    if constexpr( std::is_same<V, std::string_view>::value ) return c == '"';
+    else if constexpr( std::is_same<V, bool>::value ) return c == 't' || c == 'f';
+    else if constexpr( is_json_number<V> ) return c == '-' || ( c >= '0' && c <= '9' );
+    else if constexpr( is_vector<V>::value ) return c == '[';
+    else return c == '{';
+  }
+
+  template<typename... As> void variant( std::variant<As...>& out ){
+    char c = peek();
+    bool found = ( ( starts_with<As>( c ) ? ( value( out.template emplace<As>() ), true ) : false ) || ... );
+    if( !found ) error( "unexpected value for this variant" );
+  }
+
+  template<typename T> void object( T& out ){
+    static_assert( has_json_schema<T>, "no json_schema for this struct" );
+    using schema = typename json_schema<T>::type;
+
+    expect( '{' );
+    std::uint64_t seen = 0;
+    ws();
+    if( peek() == '}' ) ++p_;
+    else for( ;; ){
+      ws();
+      expect( '"' );
+      auto key = string();
+      ws();
+      expect( ':' );
+      ws();
+      if( !schema::find( key, out, seen, [this]( auto& member, bool again ){ if( again ) error( "duplicate key" ); value( member ); } ) ) skip();
+      ws();
+      if( peek() == ',' ){ ++p_; continue; }
+      expect( '}' );
+      break;
+    }
+    if( seen != schema::all ) error( "missing field" );
+  }
+
+  //a value that is not in the schema
+  void skip(){
+    char c = peek();
+    if( c == '"' ){
+      ++p_;
+      skip_string();
+    }else if( c == '{' || c == '[' ){
+      int depth = 0;
+      do{
+        p_ = find_structural( p_, end_ );
+        if( p_ == end_ ) error( "unterminated value" );
+        switch( *p_++ ){
+          case '"': skip_string(); break;
+          case '{': case '[': ++depth; break;
+          default: --depth;
+        }
+      }while( depth > 0 );
+    }else{
+      while( p_ != end_ && *p_ != ',' && *p_ != '}' && *p_ != ']' && *p_ != ' ' && *p_ != '\n' && *p_ != '\r' && *p_ != '\t' ) ++p_;
+    }
+  }
+
+  void skip_string(){
+    for( ;; ){
+      p_ = find_quote( p_, end_ );
+      if( p_ == end_ ) error( "unterminated string" );
+      if( *p_++ == '"' ) return;
+      if( p_ != end_ ) ++p_;  //the escaped character
+    }
+  }
+
+  char* begin_;
+  char* p_;
+  char* end_;
+};
+
+//-- the way back: json_emit( writer, root ) through the same schema
+
+template<typename W> struct json_emitter_t{
+  W& w;
+
+  template<typename V> void field( std::string_view k, V const& v ){
+    if constexpr( is_vector<V>::value ){ w.begin_array( k ); for( auto& x : v ) element( x ); w.end_array(); }
+    else if constexpr( is_variant<V>::value ) std::visit( [this, k]( auto const& x ){ field( k, x ); }, v );
+    else if constexpr( has_json_schema<V> ){ w.begin_object( k ); fields( v ); w.end_object(); }
+    else w.add_entry( k, v );
+  }
+
+  template<typename V> void element( V const& v ){
+    if constexpr( is_vector<V>::value ){ w.begin_array(); for( auto& x : v ) element( x ); w.end_array(); }
+    else if constexpr( is_variant<V>::value ) std::visit( [this]( auto const& x ){ element( x ); }, v );
+    else if constexpr( has_json_schema<V> ){ w.begin_object(); fields( v ); w.end_object(); }
+    else w.add_entry( v );
+  }
+
+  template<typename V> void fields( V const& v ){
+    json_schema<V>::type::each( v, [this]( std::string_view k, auto const& x ){ field( k, x ); } );
+  }
+};
+
+template<typename W, typename T> auto json_emit( W& w, T const& root ){
+  json_emitter_t<W> e{ w };
+  w.begin();
+  e.fields( root );
+  return w.end();
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+//the naive way: a DOM (a std::string per key and per string, a std::map per object), then copied into the struct
+
+struct naive_value_t{
+  enum kind_t { null, boolean, number, string, array, object } kind = null;
+  bool b = false;
+  double n = 0;
+  std::string s;
+  std::vector<naive_value_t> a;
+  std::map<std::string, naive_value_t> o;
+};
+
+class naive_parser_t{
+public:
+  explicit naive_parser_t( std::string const& text ) : text_{ text } {}
+
+  naive_value_t parse(){ auto v = value(); ws(); if( i_ != text_.size() ) error(); return v; }
+
+private:
+  [[noreturn]] void error() const { throw json_parse_error( "invalid json", i_ ); }
+  void ws(){ while( i_ < text_.size() && std::isspace( static_cast<unsigned char>( text_[i_] ) ) ) ++i_; }
+  char get(){ if( i_ >= text_.size() ) error(); return text_[i_++]; }
+
+  naive_value_t value(){
+    ws();
+    naive_value_t v;
+    char c = get();
+    if( c == '{' ){
+      v.kind = naive_value_t::object;
+      ws();
+      if( text_[i_] == '}' ){ ++i_; return v; }
+      for( ;; ){
+        ws();
+        if( get() != '"' ) error();
+        auto k = string();
+        ws();
+        if( get() != ':' ) error();
+        v.o[ k ] = value();
+        ws();
+        c = get();
+        if( c == '}' ) return v;
+        if( c != ',' ) error();
+      }
+    }
+    if( c == '[' ){
+      v.kind = naive_value_t::array;
+      ws();
+      if( text_[i_] == ']' ){ ++i_; return v; }
+      for( ;; ){
+        v.a.push_back( value() );
+        ws();
+        c = get();
+        if( c == ']' ) return v;
+        if( c != ',' ) error();
+      }
+    }
+    if( c == '"' ){ v.kind = naive_value_t::string; v.s = string(); return v; }
+    if( c == 't' || c == 'f' ){ v.kind = naive_value_t::boolean; v.b = c == 't'; i_ += c == 't' ? 3 : 4; return v; }
+    if( c == 'n' ){ i_ += 3; return v; }
+    --i_;
+    char* end = nullptr;
+    v.kind = naive_value_t::number;
+    v.n = std::strtod( text_.c_str() + i_, &end );
+    if( end == text_.c_str() + i_ ) error();
+    i_ = end - text_.c_str();
+    return v;
+  }
+
+  std::string string(){
+    std::string s;
+    for( ;; ){
+      char c = get();
+      if( c == '"' ) return s;
+      if( c != '\\' ){ s.push_back( c ); continue; }
+      c = get();
+      switch( c ){
+        case 'n': s.push_back( '\n' ); break;
+        case 'r': s.push_back( '\r' ); break;
+        case 't': s.push_back( '\t' ); break;
+        case 'b': s.push_back( '\b' ); break;
+        case 'f': s.push_back( '\f' ); break;
+        case 'u': s.push_back( char( std::stoi( text_.substr( i_, 4 ), nullptr, 16 ) ) ); i_ += 4; break;  //ascii only...
+        default: s.push_back( c );
+      }
+    }
+  }
+
+  std::string const& text_;
+  std::size_t i_ = 0;
+};
+
+//the DOM into the struct (the strings stay in the DOM)
+template<typename V> void from_dom( naive_value_t const& d, V& out );
+
+template<typename V> bool is_kind( naive_value_t::kind_t k ){
+  if constexpr( std::is_same<V, std::string_view>::value ) return k == naive_value_t::string;
+  else if constexpr( std::is_same<V, bool>::value ) return k == naive_value_t::boolean;
+  else if constexpr( is_json_number<V> ) return k == naive_value_t::number;
+  else if constexpr( is_vector<V>::value ) return k == naive_value_t::array;
+  else return k == naive_value_t::object;
+}
+
+template<typename... As> void from_dom_variant( naive_value_t const& d, std::variant<As...>& out ){
+  ( ( is_kind<As>( d.kind ) ? ( from_dom( d, out.template emplace<As>() ), true ) : false ) || ... );
+}
+
+template<typename V> void from_dom( naive_value_t const& d, V& out ){
+  if constexpr( std::is_same<V, std::string_view>::value ) out = d.s;
+  else if constexpr( std::is_same<V, bool>::value ) out = d.b;
+  else if constexpr( is_json_number<V> ) out = static_cast<V>( d.n );
+  else if constexpr( is_vector<V>::value ){ out.resize( d.a.size() ); for( std::size_t i=0; i<d.a.size(); ++i ) from_dom( d.a[i], out[i] ); }
+  else if constexpr( is_variant<V>::value ) from_dom_variant( d, out );
+  else json_schema<V>::type::each( out, [&d]( std::string_view k, auto& x ){ from_dom( d.o.at( std::string( k ) ), x ); } );
+}
+
+//---------------------------------------------------------------------------------------------------------------------------
+
+//the earthling from more_compile_time_magic.cpp
+
+struct description_t{ std::string_view mind, body; };
+struct earthling_t{
+  std::string_view first_name, sure_name;
+  std::vector< std::variant< std::string_view, std::vector<std::string_view> > > says;
+  description_t description;
+};
+struct earthling_doc_t{ earthling_t earthling; };
+
+template<> struct json_schema<description_t>{ using type = object< field<"mind", &description_t::mind>, field<"body", &description_t::body> >; };
+template<> struct json_schema<earthling_t>{
+  using type = object< field<"first_name", &earthling_t::first_name>, field<"sure_name", &earthling_t::sure_name>,
+                       field<"says", &earthling_t::says>, field<"description", &earthling_t::description> >;
+};
+template<> struct json_schema<earthling_doc_t>{ using type = object< field<"earthling", &earthling_doc_t::earthling> >; };
+
+//it does not compile... (a field of another struct / the same key twice / a type without a schema)
+/*
+template<> struct json_schema<earthling_doc_t>{ using type = object< field<"mind", &description_t::mind> >; };
+template<> struct json_schema<description_t>{ using type = object< field<"mind", &description_t::mind>, field<"mind", &description_t::body> >; };
+struct no_schema_t{ int x; }; struct holder_t{ no_schema_t x; };
+template<> struct json_schema<holder_t>{ using type = object< field<"x", &holder_t::x> >; };
+*/
+
+//a larger generated document
+
+struct order_t{
+  long id;
+  std::string_view customer;
+  double total;
+  bool paid;
+  std::vector<std::string_view> items;
+  std::string_view note;
+};
+struct orders_t{ std::vector<order_t> orders; };
+
+template<> struct json_schema<order_t>{
+  using type = object< field<"id", &order_t::id>, field<"customer", &order_t::customer>, field<"total", &order_t::total>,
+                       field<"paid", &order_t::paid>, field<"items", &order_t::items>, field<"note", &order_t::note> >;
+};
+template<> struct json_schema<orders_t>{ using type = object< field<"orders", &orders_t::orders> >; };
+
+//the strings live in pool
+orders_t generate_orders( int n, std::vector<std::string>& pool ){
+  std::mt19937_64 g( 1 );
+  const char* items[] = { "apple", "banana", "bread", "coffee beans 1kg", "olive oil", "tomatoes", "cheese", "rice" };
+  pool.reserve( 2*n );
+  orders_t o;
+  for( int i=0; i<n; ++i ){
+    order_t x;
+    x.id = 1000000 + i;
+    pool.push_back( "customer \"" + std::to_string( g() % 10000 ) + "\"" );  //some escaping
+    x.customer = pool.back();
+    x.total = double( g() % 100000 ) / 100;
+    x.paid = g() % 2;
+    for( int k=0, m=1+g()%4; k<m; ++k ) x.items.push_back( items[ g() % 8 ] );
+    pool.push_back( std::string( 40 + g() % 120, 'x' ) + ( i % 16 == 0 ? "\n\tdeliver to the back door" : "" ) );  //a long free text field
+    x.note = pool.back();
+    o.orders.push_back( std::move( x ) );
+  }
+  return o;
+}
+
+template<typename T> std::string to_json( T const& root ){
+  json_buffer_t buf;
+  json_writer_t<buffer_sink_t> w{ buffer_sink_t{ buf } };
+  return std::string( json_emit( w, root ) );
+}
+
+template<typename B> double bench( const char* name, std::size_t bytes, int samples, B body ){
+  auto start = std::chrono::high_resolution_clock::now();
+  for( int i=0; i<samples; ++i ) body();
+  auto stop = std::chrono::high_resolution_clock::now();
+  double ns = std::chrono::duration_cast<std::chrono::nanoseconds>( stop - start ).count() / double( samples );
+  std::cout << name << " ns per document: " << ns << " MB/s: " << bytes * 1000.0 / ns << "\n";
+  return ns;
+}
+
+//parse, emit again, compare; then schema parser vs naive parser
+template<typename T> void test_round_trip( const char* name, std::string const& json, int samples ){
+  std::cout << name << " (" << json.size() << " bytes)\n";
+
+  std::string text = json;
+  T doc;
+  json_parser_t( text ).parse( doc );
+  bool err = to_json( doc ) != json;
+
+  naive_value_t dom = naive_parser_t( json ).parse();
+  T doc2;
+  from_dom( dom, doc2 );
+  err = err || to_json( doc2 ) != json;
+  std::cout << "test..." << ( err ? "failed" : "passed" ) << "\n";
+
+  //parsing unescapes in place, so each run parses a fresh copy (the copy is in the time, it is a memcpy into the same buffer)
+  auto s = bench( "json_parser_t", json.size(), samples, [&json, &text](){ text = json; T d; json_parser_t( text ).parse( d ); asm volatile( "" : : "r"( &d ) : "memory" ); } );
+  auto n = bench( "naive_parser_t + from_dom", json.size(), samples, [&json](){ T d; auto v = naive_parser_t( json ).parse(); from_dom( v, d ); asm volatile( "" : : "r"( &d ) : "memory" ); } );
+  std::cout << "naive / json_parser_t: " << n / s << "x\n";
+}
+
+void test_errors(){
+  auto fails = []( std::string text ){
+    try{ earthling_doc_t d; json_parser_t( text ).parse( d ); }catch( json_parse_error const& ){ return true; }
+    return false;
+  };
+  std::string ok = R"({"earthling":{"first_name":"stefan","sure_name":"popa","says":[],"description":{"mind":"funny","body":"unknown"},"extra":{"a":[1,"}"]}}})";
+  bool err = fails( ok )                                                    //an unknown key is skipped
+          || !fails( R"({"earthling":{"first_name":"stefan"}})" )          //missing fields
+          || !fails( R"({"earthling":{"first_name":stefan}})" )            //not a string
+          || !fails( ok + "x" )                                            //trailing characters
+          || !fails( R"({"earthling":{"first_name":"stef)" )               //unterminated
+          || !fails( R"({"earthling":{"first_name":"a","first_name":"b","sure_name":"popa","says":[],"description":{"mind":"funny","body":"unknown"}}})" )  //duplicate key
+          || !fails( R"({"earthling":{"first_name":"\udc00","sure_name":"popa","says":[],"description":{"mind":"funny","body":"unknown"}}})" );           //lone low surrogate
+  auto bad_number = []( std::string n ){
+    std::string text = R"({"orders":[{"id":)" + n + R"(,"customer":"c","total":1,"paid":true,"items":[],"note":""}]})";
+    try{ orders_t o; json_parser_t( text ).parse( o ); }catch( json_parse_error const& ){ return true; }
+    return false;
+  };
+  err = err || bad_number( "-12" ) || !bad_number( "012" ) || !bad_number( "-" ) || !bad_number( "+1" ) || !bad_number( "1.5" ) || !bad_number( "99999999999999999999" );
+  std::string esc = R"({"mind":"a\"b\\c\né😀","body":"x"})";
+  description_t d;
+  json_parser_t( esc ).parse( d );
+  err = err || d.mind != "a\"b\\c\n\xc3\xa9\xf0\x9f\x98\x80";
+  std::cout << "test_errors..." << ( err ? "failed" : "passed" ) << "\n";
+}
+
+/*
+Example (on a 1 vcpu vm, -O2, a noisy one: the runs vary by +-30%):
+
+earthling (152 bytes)
+json_parser_t ns per document: 719.346 MB/s: 211.303
+naive_parser_t + from_dom ns per document: 4770.72 MB/s: 31.861
+naive / json_parser_t: 6.63203x
+100 orders (22277 bytes)
+json_parser_t ns per document: 60349.2 MB/s: 369.135
+naive_parser_t + from_dom ns per document: 545773 MB/s: 40.8174
+naive / json_parser_t: 9.04358x
+10000 orders (2201873 bytes)
+json_parser_t ns per document: 7.44707e+06 MB/s: 295.67
+naive_parser_t + from_dom ns per document: 7.07621e+07 MB/s: 31.1166
+naive / json_parser_t: 9.502x
+
+-DJSON_NO_SIMD (json_parser_t only):
+earthling      MB/s: 152.471
+100 orders     MB/s: 236.523
+10000 orders   MB/s: 192.391
+
+The SSE2 scanning pays off on the long strings (the notes); what is left is per value work
+(from_chars, the key compares, the vectors of the struct).
+*/
+
+int main(){
+  test_errors();
+
+  std::string earthling = R"({"earthling":{"first_name":"stefan","sure_name":"popa","says":["hello","world...",["pam...","pam..."]],"description":{"mind":"funny","body":"unknown"}}})";
+  test_round_trip<earthling_doc_t>( "earthling", earthling, 200000 );
+
+  for( int n : { 100, 10000 } ){
+    std::vector<std::string> pool;
+    auto json = to_json( generate_orders( n, pool ) );
+    test_round_trip<orders_t>( n == 100 ? "100 orders" : "10000 orders", json, n == 100 ? 10000 : 100 );
+  }
+  return 0;
+}